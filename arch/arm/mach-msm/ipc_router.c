@@ -28,6 +28,8 @@
 #include <linux/uaccess.h>
 #include <linux/debugfs.h>
 #include <linux/rwsem.h>
+#include <linux/rculist.h>
+#include <linux/srcu.h>
 
 #include <asm/uaccess.h>
 #include <asm/byteorder.h>
@@ -170,12 +172,20 @@ struct msm_ipc_routing_table_entry {
 	struct rw_semaphore lock_lha4;
 	unsigned long num_tx_bytes;
 	unsigned long num_rx_bytes;
+	struct list_head free_list;
 };
 
 static struct list_head routing_table[RT_HASH_SIZE];
 static DECLARE_RWSEM(routing_table_lock_lha3);
 static int routing_table_inited;
 
+/*
+ * Protects data path lookups of local ports, routing table entries and
+ * remote ports. Readers may sleep, writers still take the table rwsems
+ * and must drop them before synchronize_srcu().
+ */
+static struct srcu_struct ipc_rtr_srcu;
+
 static void do_read_data(struct work_struct *work);
 
 static LIST_HEAD(xprt_info_list);
@@ -198,6 +208,7 @@ static void init_routing_table(void)
 	int i;
 	for (i = 0; i < RT_HASH_SIZE; i++)
 		INIT_LIST_HEAD(&routing_table[i]);
+	init_srcu_struct(&ipc_rtr_srcu);
 }
 
 static struct msm_ipc_routing_table_entry *alloc_routing_table_entry(
@@ -232,7 +243,7 @@ static int add_routing_table_entry(
 		return -EINVAL;
 
 	key = (rt_entry->node_id % RT_HASH_SIZE);
-	list_add_tail(&rt_entry->list, &routing_table[key]);
+	list_add_tail_rcu(&rt_entry->list, &routing_table[key]);
 	return 0;
 }
 
@@ -242,7 +253,7 @@ static struct msm_ipc_routing_table_entry *lookup_routing_table(
 	uint32_t key = (node_id % RT_HASH_SIZE);
 	struct msm_ipc_routing_table_entry *rt_entry;
 
-	list_for_each_entry(rt_entry, &routing_table[key], list) {
+	list_for_each_entry_rcu(rt_entry, &routing_table[key], list) {
 		if (rt_entry->node_id == node_id)
 			return rt_entry;
 	}
@@ -442,7 +453,7 @@ static void *msm_ipc_router_skb_to_buf(struct sk_buff_head *skb_head,
 	}
 	skb_queue_walk(skb_head, temp) {
 		copy_len = buf_len < temp->len ? buf_len : temp->len;
-		memcpy(buf + offset, temp->data, copy_len);
+		skb_copy_bits(temp, 0, buf + offset, copy_len);
 		offset += copy_len;
 		buf_len -= copy_len;
 	}
@@ -470,6 +481,10 @@ static int extract_header_v1(struct rr_packet *pkt, struct sk_buff *skb)
 		return -EINVAL;
 	}
 
+	if (!pskb_may_pull(skb, sizeof(struct rr_header_v1))) {
+		pr_err("%s: Short header\n", __func__);
+		return -EINVAL;
+	}
 	memcpy(&pkt->hdr, skb->data, sizeof(struct rr_header_v1));
 	skb_pull(skb, sizeof(struct rr_header_v1));
 	pkt->length -= sizeof(struct rr_header_v1);
@@ -485,6 +500,10 @@ static int extract_header_v2(struct rr_packet *pkt, struct sk_buff *skb)
 		return -EINVAL;
 	}
 
+	if (!pskb_may_pull(skb, sizeof(struct rr_header_v2))) {
+		pr_err("%s: Short header\n", __func__);
+		return -EINVAL;
+	}
 	hdr = (struct rr_header_v2 *)skb->data;
 	pkt->hdr.version = (uint32_t)hdr->version;
 	pkt->hdr.type = (uint32_t)hdr->type;
@@ -510,7 +529,7 @@ static int extract_header(struct rr_packet *pkt)
 	}
 
 	temp_skb = skb_peek(pkt->pkt_fragment_q);
-	if (!temp_skb || !temp_skb->data) {
+	if (!temp_skb || !temp_skb->data || !pskb_may_pull(temp_skb, 1)) {
 		pr_err("%s: No SKBs in skb_queue\n", __func__);
 		return -EINVAL;
 	}
@@ -524,7 +543,8 @@ static int extract_header(struct rr_packet *pkt)
 		pr_err("%s: Invalid Header version %02x\n",
 			__func__, temp_skb->data[0]);
 		print_hex_dump(KERN_ERR, "Header: ", DUMP_PREFIX_ADDRESS,
-			       16, 1, temp_skb->data, pkt->length, true);
+			       16, 1, temp_skb->data, skb_headlen(temp_skb),
+			       true);
 		return -EINVAL;
 	}
 	return ret;
@@ -646,6 +666,19 @@ static int prepend_header_v2(struct rr_packet *pkt, int hdr_size)
 	return 0;
 }
 
+static int linearize_pkt_fragments(struct rr_packet *pkt)
+{
+	struct sk_buff *temp_skb;
+
+	skb_queue_walk(pkt->pkt_fragment_q, temp_skb) {
+		if (skb_linearize(temp_skb)) {
+			pr_err("%s: Linearize failed\n", __func__);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
 static int prepend_header(struct rr_packet *pkt,
 			  struct msm_ipc_router_xprt_info *xprt_info)
 {
@@ -702,7 +735,7 @@ static int defragment_pkt(struct rr_packet *pkt)
 
 	skb_queue_walk(pkt->pkt_fragment_q, src_skb) {
 		copy_len =  buf_len < src_skb->len ? buf_len : src_skb->len;
-		memcpy(buf + offset, src_skb->data, copy_len);
+		skb_copy_bits(src_skb, 0, buf + offset, copy_len);
 		offset += copy_len;
 		buf_len -= copy_len;
 	}
@@ -807,7 +840,7 @@ void msm_ipc_router_add_local_port(struct msm_ipc_port *port_ptr)
 
 	key = (port_ptr->this_port.port_id & (LP_HASH_SIZE - 1));
 	down_write(&local_ports_lock_lha2);
-	list_add_tail(&port_ptr->list, &local_ports[key]);
+	list_add_tail_rcu(&port_ptr->list, &local_ports[key]);
 	up_write(&local_ports_lock_lha2);
 }
 
@@ -853,7 +886,7 @@ static struct msm_ipc_port *msm_ipc_router_lookup_local_port(uint32_t port_id)
 	int key = (port_id & (LP_HASH_SIZE - 1));
 	struct msm_ipc_port *port_ptr;
 
-	list_for_each_entry(port_ptr, &local_ports[key], list) {
+	list_for_each_entry_rcu(port_ptr, &local_ports[key], list) {
 		if (port_ptr->this_port.port_id == port_id) {
 			return port_ptr;
 		}
@@ -875,15 +908,11 @@ static struct msm_ipc_router_remote_port *msm_ipc_router_lookup_remote_port(
 		return NULL;
 	}
 
-	down_read(&rt_entry->lock_lha4);
-	list_for_each_entry(rport_ptr,
-			    &rt_entry->remote_port_list[key], list) {
-		if (rport_ptr->port_id == port_id) {
-			up_read(&rt_entry->lock_lha4);
+	list_for_each_entry_rcu(rport_ptr,
+				&rt_entry->remote_port_list[key], list) {
+		if (rport_ptr->port_id == port_id)
 			return rport_ptr;
-		}
 	}
-	up_read(&rt_entry->lock_lha4);
 	return NULL;
 }
 
@@ -915,8 +944,8 @@ static struct msm_ipc_router_remote_port *msm_ipc_router_create_remote_port(
 	mutex_init(&rport_ptr->quota_lock_lhb2);
 	INIT_LIST_HEAD(&rport_ptr->resume_tx_port_list);
 	down_write(&rt_entry->lock_lha4);
-	list_add_tail(&rport_ptr->list,
-		      &rt_entry->remote_port_list[key]);
+	list_add_tail_rcu(&rport_ptr->list,
+			  &rt_entry->remote_port_list[key]);
 	up_write(&rt_entry->lock_lha4);
 	return rport_ptr;
 }
@@ -984,13 +1013,16 @@ static void msm_ipc_router_destroy_remote_port(
 		return;
 	}
 	down_write(&rt_entry->lock_lha4);
-	list_del(&rport_ptr->list);
+	list_del_rcu(&rport_ptr->list);
 	up_write(&rt_entry->lock_lha4);
-	mutex_lock(&rport_ptr->quota_lock_lhb2);
+	return;
+}
+
+static void msm_ipc_router_free_remote_port(
+	struct msm_ipc_router_remote_port *rport_ptr)
+{
 	msm_ipc_router_free_resume_tx_port(rport_ptr);
-	mutex_unlock(&rport_ptr->quota_lock_lhb2);
 	kfree(rport_ptr);
-	return;
 }
 
 static struct msm_ipc_server *msm_ipc_router_lookup_server(
@@ -1363,11 +1395,12 @@ static int forward_msg(struct msm_ipc_router_xprt_info *xprt_info,
 		goto fm_error2;
 	}
 	fwd_xprt_option = fwd_xprt_info->xprt->get_option(fwd_xprt_info->xprt);
-	if (!(fwd_xprt_option & FRAG_PKT_WRITE_ENABLE)) {
+	if (!(fwd_xprt_option & FRAG_PKT_WRITE_ENABLE))
 		ret = defragment_pkt(pkt);
-		if (ret < 0)
-			goto fm_error2;
-	}
+	else
+		ret = linearize_pkt_fragments(pkt);
+	if (ret < 0)
+		goto fm_error2;
 
 	mutex_lock(&fwd_xprt_info->tx_lock_lhb2);
 	if (xprt_info->remote_node_id == fwd_xprt_info->remote_node_id) {
@@ -1480,19 +1513,14 @@ static void cleanup_rmt_server(struct msm_ipc_router_xprt_info *xprt_info,
 static void cleanup_rmt_ports(struct msm_ipc_router_xprt_info *xprt_info,
 			      struct msm_ipc_routing_table_entry *rt_entry)
 {
-	struct msm_ipc_router_remote_port *rport_ptr, *tmp_rport_ptr;
+	struct msm_ipc_router_remote_port *rport_ptr;
 	union rr_control_msg ctl;
 	int j;
 
 	memset(&ctl, 0, sizeof(ctl));
 	for (j = 0; j < RP_HASH_SIZE; j++) {
-		list_for_each_entry_safe(rport_ptr, tmp_rport_ptr,
+		list_for_each_entry(rport_ptr,
 				&rt_entry->remote_port_list[j], list) {
-			list_del(&rport_ptr->list);
-			mutex_lock(&rport_ptr->quota_lock_lhb2);
-			msm_ipc_router_free_resume_tx_port(rport_ptr);
-			mutex_unlock(&rport_ptr->quota_lock_lhb2);
-
 			if (rport_ptr->server)
 				cleanup_rmt_server(xprt_info, rport_ptr);
 
@@ -1501,16 +1529,30 @@ static void cleanup_rmt_ports(struct msm_ipc_router_xprt_info *xprt_info,
 			ctl.cli.port_id = rport_ptr->port_id;
 			relay_ctl_msg(xprt_info, &ctl);
 			broadcast_ctl_msg_locally(&ctl);
-			kfree(rport_ptr);
 		}
 	}
 }
 
+static void free_routing_table_entry(
+	struct msm_ipc_routing_table_entry *rt_entry)
+{
+	struct msm_ipc_router_remote_port *rport_ptr, *tmp_rport_ptr;
+	int j;
+
+	for (j = 0; j < RP_HASH_SIZE; j++) {
+		list_for_each_entry_safe(rport_ptr, tmp_rport_ptr,
+				&rt_entry->remote_port_list[j], list)
+			msm_ipc_router_free_remote_port(rport_ptr);
+	}
+	kfree(rt_entry);
+}
+
 static void msm_ipc_cleanup_routing_table(
 	struct msm_ipc_router_xprt_info *xprt_info)
 {
 	int i;
 	struct msm_ipc_routing_table_entry *rt_entry, *tmp_rt_entry;
+	LIST_HEAD(dead_rt_entries);
 
 	if (!xprt_info) {
 		pr_err("%s: Invalid xprt_info\n", __func__);
@@ -1530,12 +1572,20 @@ static void msm_ipc_cleanup_routing_table(
 			cleanup_rmt_ports(xprt_info, rt_entry);
 			rt_entry->xprt_info = NULL;
 			up_write(&rt_entry->lock_lha4);
-			list_del(&rt_entry->list);
-			kfree(rt_entry);
+			list_del_rcu(&rt_entry->list);
+			list_add_tail(&rt_entry->free_list, &dead_rt_entries);
 		}
 	}
 	up_write(&routing_table_lock_lha3);
 	up_write(&server_list_lock_lha2);
+
+	if (list_empty(&dead_rt_entries))
+		return;
+
+	synchronize_srcu(&ipc_rtr_srcu);
+	list_for_each_entry_safe(rt_entry, tmp_rt_entry,
+				 &dead_rt_entries, free_list)
+		free_routing_table_entry(rt_entry);
 }
 
 static void sync_sec_rule(struct msm_ipc_server *server, void *rule)
@@ -1664,12 +1714,12 @@ static int process_resume_tx_msg(union rr_control_msg *msg,
 				 struct rr_packet *pkt)
 {
 	struct msm_ipc_router_remote_port *rport_ptr;
+	int idx;
 	int ret = 0;
 
 	RR("o RESUME_TX id=%d:%08x\n", msg->cli.node_id, msg->cli.port_id);
 
-	down_read(&local_ports_lock_lha2);
-	down_read(&routing_table_lock_lha3);
+	idx = srcu_read_lock(&ipc_rtr_srcu);
 	rport_ptr = msm_ipc_router_lookup_remote_port(msg->cli.node_id,
 						      msg->cli.port_id);
 	if (!rport_ptr) {
@@ -1682,8 +1732,7 @@ static int process_resume_tx_msg(union rr_control_msg *msg,
 	post_resume_tx(rport_ptr, pkt);
 	mutex_unlock(&rport_ptr->quota_lock_lhb2);
 prtm_out:
-	up_read(&routing_table_lock_lha3);
-	up_read(&local_ports_lock_lha2);
+	srcu_read_unlock(&ipc_rtr_srcu, idx);
 	return 0;
 }
 
@@ -1789,6 +1838,11 @@ static int process_rmv_client_msg(struct msm_ipc_router_xprt_info *xprt_info,
 		msm_ipc_router_destroy_remote_port(rport_ptr);
 	up_write(&routing_table_lock_lha3);
 
+	if (rport_ptr) {
+		synchronize_srcu(&ipc_rtr_srcu);
+		msm_ipc_router_free_remote_port(rport_ptr);
+	}
+
 	relay_ctl_msg(xprt_info, msg);
 	post_control_ports(pkt);
 	return 0;
@@ -1849,6 +1903,7 @@ static void do_read_data(struct work_struct *work)
 	struct msm_ipc_port *port_ptr;
 	struct msm_ipc_router_remote_port *rport_ptr;
 	int ret;
+	int idx;
 
 	struct msm_ipc_router_xprt_info *xprt_info =
 		container_of(work,
@@ -1901,36 +1956,35 @@ static void do_read_data(struct work_struct *work)
 #endif
 #endif
 
-		down_read(&local_ports_lock_lha2);
+		idx = srcu_read_lock(&ipc_rtr_srcu);
 		port_ptr = msm_ipc_router_lookup_local_port(hdr->dst_port_id);
 		if (!port_ptr) {
 			pr_err("%s: No local port id %08x\n", __func__,
 				hdr->dst_port_id);
-			up_read(&local_ports_lock_lha2);
+			srcu_read_unlock(&ipc_rtr_srcu, idx);
 			release_pkt(pkt);
 			return;
 		}
 
-		down_read(&routing_table_lock_lha3);
 		rport_ptr = msm_ipc_router_lookup_remote_port(hdr->src_node_id,
 							hdr->src_port_id);
 		if (!rport_ptr) {
+			down_read(&routing_table_lock_lha3);
 			rport_ptr = msm_ipc_router_create_remote_port(
 							hdr->src_node_id,
 							hdr->src_port_id);
+			up_read(&routing_table_lock_lha3);
 			if (!rport_ptr) {
 				pr_err("%s: Rmt Prt %08x:%08x create failed\n",
 					__func__, hdr->src_node_id,
 					hdr->src_port_id);
-				up_read(&routing_table_lock_lha3);
-				up_read(&local_ports_lock_lha2);
+				srcu_read_unlock(&ipc_rtr_srcu, idx);
 				release_pkt(pkt);
 				return;
 			}
 		}
-		up_read(&routing_table_lock_lha3);
 		post_pkt_to_port(port_ptr, pkt, 0);
-		up_read(&local_ports_lock_lha2);
+		srcu_read_unlock(&ipc_rtr_srcu, idx);
 	}
 	return;
 
@@ -2049,6 +2103,7 @@ static int loopback_data(struct msm_ipc_port *src,
 	struct msm_ipc_port *port_ptr;
 	struct rr_packet *pkt;
 	int ret_len;
+	int idx;
 
 	if (!data) {
 		pr_err("%s: Invalid pkt pointer\n", __func__);
@@ -2070,11 +2125,11 @@ static int loopback_data(struct msm_ipc_port *src,
 	hdr->dst_node_id = IPC_ROUTER_NID_LOCAL;
 	hdr->dst_port_id = port_id;
 
-	down_read(&local_ports_lock_lha2);
+	idx = srcu_read_lock(&ipc_rtr_srcu);
 	port_ptr = msm_ipc_router_lookup_local_port(port_id);
 	if (!port_ptr) {
 		pr_err("%s: Local port %d not present\n", __func__, port_id);
-		up_read(&local_ports_lock_lha2);
+		srcu_read_unlock(&ipc_rtr_srcu, idx);
 		pkt->pkt_fragment_q = NULL;
 		release_pkt(pkt);
 		return -ENODEV;
@@ -2083,7 +2138,7 @@ static int loopback_data(struct msm_ipc_port *src,
 	ret_len = pkt->length;
 	post_pkt_to_port(port_ptr, pkt, 0);
 	update_comm_mode_info(&src->mode_info, NULL);
-	up_read(&local_ports_lock_lha2);
+	srcu_read_unlock(&ipc_rtr_srcu, idx);
 
 	return ret_len;
 }
@@ -2217,6 +2272,7 @@ int msm_ipc_router_send_to(struct msm_ipc_port *src,
 	struct msm_ipc_router_remote_port *rport_ptr = NULL;
 	struct rr_packet *pkt;
 	int ret;
+	int idx;
 
 	if (!src || !data || !dest) {
 		pr_err("%s: Invalid Parameters\n", __func__);
@@ -2250,11 +2306,11 @@ int msm_ipc_router_send_to(struct msm_ipc_port *src,
 		return ret;
 	}
 
-	down_read(&routing_table_lock_lha3);
+	idx = srcu_read_lock(&ipc_rtr_srcu);
 	rport_ptr = msm_ipc_router_lookup_remote_port(dst_node_id,
 						      dst_port_id);
 	if (!rport_ptr) {
-		up_read(&routing_table_lock_lha3);
+		srcu_read_unlock(&ipc_rtr_srcu, idx);
 		pr_err("%s: Remote port not found\n", __func__);
 		return -ENODEV;
 	}
@@ -2262,7 +2318,7 @@ int msm_ipc_router_send_to(struct msm_ipc_port *src,
 	if (src->check_send_permissions) {
 		ret = src->check_send_permissions(rport_ptr->sec_rule);
 		if (ret <= 0) {
-			up_read(&routing_table_lock_lha3);
+			srcu_read_unlock(&ipc_rtr_srcu, idx);
 			pr_err("%s: permission failure for %s\n",
 				__func__, current->comm);
 			return -EPERM;
@@ -2271,13 +2327,13 @@ int msm_ipc_router_send_to(struct msm_ipc_port *src,
 
 	pkt = create_pkt(data);
 	if (!pkt) {
-		up_read(&routing_table_lock_lha3);
+		srcu_read_unlock(&ipc_rtr_srcu, idx);
 		pr_err("%s: Pkt creation failed\n", __func__);
 		return -ENOMEM;
 	}
 
 	ret = msm_ipc_router_write_pkt(src, rport_ptr, pkt);
-	up_read(&routing_table_lock_lha3);
+	srcu_read_unlock(&ipc_rtr_srcu, idx);
 	if (ret < 0)
 		pkt->pkt_fragment_q = NULL;
 	release_pkt(pkt);
@@ -2437,7 +2493,7 @@ int msm_ipc_router_recv_from(struct msm_ipc_port *port_ptr,
 	align_size = ALIGN_SIZE(data_len);
 	if (align_size) {
 		temp_skb = skb_peek_tail((*pkt)->pkt_fragment_q);
-		skb_trim(temp_skb, (temp_skb->len - align_size));
+		pskb_trim(temp_skb, (temp_skb->len - align_size));
 	}
 	return data_len;
 }
@@ -2498,8 +2554,9 @@ int msm_ipc_router_close_port(struct msm_ipc_port *port_ptr)
 
 	if (port_ptr->type == SERVER_PORT || port_ptr->type == CLIENT_PORT) {
 		down_write(&local_ports_lock_lha2);
-		list_del(&port_ptr->list);
+		list_del_rcu(&port_ptr->list);
 		up_write(&local_ports_lock_lha2);
+		synchronize_srcu(&ipc_rtr_srcu);
 
 		if (port_ptr->type == SERVER_PORT) {
 			memset(&msg, 0, sizeof(msg));
@@ -2526,8 +2583,9 @@ int msm_ipc_router_close_port(struct msm_ipc_port *port_ptr)
 		up_write(&control_ports_lock_lha5);
 	} else if (port_ptr->type == IRSC_PORT) {
 		down_write(&local_ports_lock_lha2);
-		list_del(&port_ptr->list);
+		list_del_rcu(&port_ptr->list);
 		up_write(&local_ports_lock_lha2);
+		synchronize_srcu(&ipc_rtr_srcu);
 		signal_irsc_completion();
 	}
 
@@ -2582,8 +2640,9 @@ int msm_ipc_router_bind_control_port(struct msm_ipc_port *port_ptr)
 		return -EINVAL;
 
 	down_write(&local_ports_lock_lha2);
-	list_del(&port_ptr->list);
+	list_del_rcu(&port_ptr->list);
 	up_write(&local_ports_lock_lha2);
+	synchronize_srcu(&ipc_rtr_srcu);
 	port_ptr->type = CONTROL_PORT;
 	down_write(&control_ports_lock_lha5);
 	list_add_tail(&port_ptr->list, &control_ports);
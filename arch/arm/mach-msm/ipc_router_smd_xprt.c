@@ -36,6 +36,7 @@ if (msm_ipc_router_smd_xprt_debug_mask) \
 #endif
 
 #define MIN_FRAG_SZ (IPC_ROUTER_HDR_SIZE + sizeof(union rr_control_msg))
+#define PAGED_SKB_HEAD_SZ 128
 
 #define NUM_SMD_XPRTS 4
 #define XPRT_NAME_LEN (SMD_MAX_CH_NAME_LEN + 12)
@@ -221,11 +222,56 @@ static void smd_xprt_sft_close_done(struct msm_ipc_router_xprt *xprt)
 	complete_all(&smd_xprtp->sft_close_complete);
 }
 
+static struct sk_buff *smd_xprt_alloc_paged_skb(int sz)
+{
+	struct sk_buff *skb;
+	struct page *page;
+	int i, len;
+
+	skb = alloc_skb(PAGED_SKB_HEAD_SZ, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	skb_put(skb, PAGED_SKB_HEAD_SZ);
+	sz -= PAGED_SKB_HEAD_SZ;
+
+	for (i = 0; sz > 0 && i < MAX_SKB_FRAGS; i++) {
+		page = alloc_page(GFP_KERNEL);
+		if (!page)
+			break;
+		len = min_t(int, sz, PAGE_SIZE);
+		skb_fill_page_desc(skb, i, page, 0, len);
+		skb->len += len;
+		skb->data_len += len;
+		skb->truesize += PAGE_SIZE;
+		sz -= len;
+	}
+	return skb;
+}
+
+static int smd_xprt_read_skb(smd_channel_t *channel, struct sk_buff *skb)
+{
+	skb_frag_t *frag;
+	int i, sz_read, len;
+
+	sz_read = smd_read(channel, skb->data, skb_headlen(skb));
+	if (sz_read != skb_headlen(skb))
+		return sz_read;
+
+	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++) {
+		frag = &skb_shinfo(skb)->frags[i];
+		len = smd_read(channel, skb_frag_address(frag),
+			       skb_frag_size(frag));
+		if (len != skb_frag_size(frag))
+			return -EIO;
+		sz_read += len;
+	}
+	return sz_read;
+}
+
 static void smd_xprt_read_data(struct work_struct *work)
 {
 	int pkt_size, sz_read, sz;
 	struct sk_buff *ipc_rtr_pkt;
-	void *data;
 	unsigned long flags;
 	struct delayed_work *rwork = to_delayed_work(work);
 	struct msm_ipc_router_smd_xprt *smd_xprtp =
@@ -278,7 +324,13 @@ static void smd_xprt_read_data(struct work_struct *work)
 			return;
 
 		sz = smd_read_avail(smd_xprtp->channel);
-		do {
+		ipc_rtr_pkt = NULL;
+		if (sz > PAGE_SIZE) {
+			ipc_rtr_pkt = smd_xprt_alloc_paged_skb(sz);
+			if (ipc_rtr_pkt)
+				sz = ipc_rtr_pkt->len;
+		}
+		while (!ipc_rtr_pkt) {
 			ipc_rtr_pkt = alloc_skb(sz, GFP_KERNEL);
 			if (!ipc_rtr_pkt) {
 				if (sz <= (PAGE_SIZE/2)) {
@@ -289,12 +341,13 @@ static void smd_xprt_read_data(struct work_struct *work)
 					return;
 				}
 				sz = sz / 2;
+				continue;
 			}
-		} while (!ipc_rtr_pkt);
+			skb_put(ipc_rtr_pkt, sz);
+		}
 
 		D("%s: Allocated the sk_buff of size %d\n", __func__, sz);
-		data = skb_put(ipc_rtr_pkt, sz);
-		sz_read = smd_read(smd_xprtp->channel, data, sz);
+		sz_read = smd_xprt_read_skb(smd_xprtp->channel, ipc_rtr_pkt);
 		if (sz_read != sz) {
 			pr_err("%s: Couldn't read %s completely\n",
 				__func__, smd_xprtp->xprt.name);
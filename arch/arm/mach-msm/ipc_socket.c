@@ -71,6 +71,9 @@ static void msm_ipc_router_ipc_log(uint8_t tran,
 {
 	struct qmi_header *hdr = (struct qmi_header *)ipc_buf->data;
 
+	if (skb_headlen(ipc_buf) < sizeof(*hdr))
+		return;
+
 	if (ipc_req_resp_log_txt &&
 		(((uint8_t) hdr->cntl_flag == QMI_REQUEST_CONTROL_FLAG) ||
 		((uint8_t) hdr->cntl_flag == QMI_RESPONSE_CONTROL_FLAG)) &&
@@ -188,7 +191,7 @@ static int msm_ipc_router_extract_msg(struct msghdr *m,
 	struct sockaddr_msm_ipc *addr;
 	struct rr_header_v1 *hdr;
 	struct sk_buff *temp;
-	union rr_control_msg *ctl_msg;
+	union rr_control_msg ctl_msg;
 	int offset = 0, data_len = 0, copy_len;
 
 	if (!m || !pkt) {
@@ -200,11 +203,12 @@ static int msm_ipc_router_extract_msg(struct msghdr *m,
 	hdr = &(pkt->hdr);
 	if (addr && (hdr->type == IPC_ROUTER_CTRL_CMD_RESUME_TX)) {
 		temp = skb_peek(pkt->pkt_fragment_q);
-		ctl_msg = (union rr_control_msg *)(temp->data);
+		if (skb_copy_bits(temp, 0, &ctl_msg, sizeof(ctl_msg)))
+			return -EINVAL;
 		addr->family = AF_MSM_IPC;
 		addr->address.addrtype = MSM_IPC_ADDR_ID;
-		addr->address.addr.port_addr.node_id = ctl_msg->cli.node_id;
-		addr->address.addr.port_addr.port_id = ctl_msg->cli.port_id;
+		addr->address.addr.port_addr.node_id = ctl_msg.cli.node_id;
+		addr->address.addr.port_addr.port_id = ctl_msg.cli.port_id;
 		m->msg_namelen = sizeof(struct sockaddr_msm_ipc);
 		return offset;
 	}
@@ -219,8 +223,7 @@ static int msm_ipc_router_extract_msg(struct msghdr *m,
 	data_len = hdr->size;
 	skb_queue_walk(pkt->pkt_fragment_q, temp) {
 		copy_len = data_len < temp->len ? data_len : temp->len;
-		if (copy_to_user(m->msg_iov->iov_base + offset, temp->data,
-				 copy_len)) {
+		if (skb_copy_datagram_iovec(temp, 0, m->msg_iov, copy_len)) {
 			pr_err("%s: Copy to user failed\n", __func__);
 			return -EFAULT;
 		}
@@ -380,9 +383,6 @@ static int msm_ipc_router_recvmsg(struct kiocb *iocb, struct socket *sock,
 	long timeout;
 	int ret;
 
-	if (m->msg_iovlen != 1)
-		return -EOPNOTSUPP;
-
 	if (!buf_len)
 		return -EINVAL;
 
@@ -39,9 +39,37 @@ static void sync_dump(struct sync_fence *fence);
 static LIST_HEAD(sync_timeline_list_head);
 static DEFINE_SPINLOCK(sync_timeline_list_lock);
 
+#ifdef CONFIG_SYNC_FENCE_LIST
 static LIST_HEAD(sync_fence_list_head);
 static DEFINE_SPINLOCK(sync_fence_list_lock);
 
+static void sync_fence_list_add(struct sync_fence *fence)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sync_fence_list_lock, flags);
+	list_add_tail(&fence->sync_fence_list, &sync_fence_list_head);
+	spin_unlock_irqrestore(&sync_fence_list_lock, flags);
+}
+
+static void sync_fence_list_del(struct sync_fence *fence)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&sync_fence_list_lock, flags);
+	list_del(&fence->sync_fence_list);
+	spin_unlock_irqrestore(&sync_fence_list_lock, flags);
+}
+#else
+static inline void sync_fence_list_add(struct sync_fence *fence)
+{
+}
+
+static inline void sync_fence_list_del(struct sync_fence *fence)
+{
+}
+#endif
+
 struct sync_timeline *sync_timeline_create(const struct sync_timeline_ops *ops,
 					   int size, const char *name)
 {
@@ -62,8 +90,8 @@ struct sync_timeline *sync_timeline_create(const struct sync_timeline_ops *ops,
 	INIT_LIST_HEAD(&obj->child_list_head);
 	spin_lock_init(&obj->child_list_lock);
 
-	INIT_LIST_HEAD(&obj->active_list_head);
-	spin_lock_init(&obj->active_list_lock);
+	obj->active_tree = RB_ROOT;
+	spin_lock_init(&obj->active_lock);
 
 	spin_lock_irqsave(&sync_timeline_list_lock, flags);
 	list_add_tail(&obj->sync_timeline_list, &sync_timeline_list_head);
@@ -116,10 +144,12 @@ static void sync_timeline_remove_pt(struct sync_pt *pt)
 	struct sync_timeline *obj = pt->parent;
 	unsigned long flags;
 
-	spin_lock_irqsave(&obj->active_list_lock, flags);
-	if (!list_empty(&pt->active_list))
-		list_del_init(&pt->active_list);
-	spin_unlock_irqrestore(&obj->active_list_lock, flags);
+	spin_lock_irqsave(&obj->active_lock, flags);
+	if (!RB_EMPTY_NODE(&pt->active_node)) {
+		rb_erase(&pt->active_node, &obj->active_tree);
+		RB_CLEAR_NODE(&pt->active_node);
+	}
+	spin_unlock_irqrestore(&obj->active_lock, flags);
 
 	spin_lock_irqsave(&obj->child_list_lock, flags);
 	if (!list_empty(&pt->child_list)) {
@@ -133,23 +163,30 @@ void sync_timeline_signal(struct sync_timeline *obj)
 	unsigned long flags;
 	LIST_HEAD(signaled_pts);
 	struct list_head *pos, *n;
+	struct rb_node *node;
 
 	trace_sync_timeline(obj);
 
-	spin_lock_irqsave(&obj->active_list_lock, flags);
+	spin_lock_irqsave(&obj->active_lock, flags);
 
-	list_for_each_safe(pos, n, &obj->active_list_head) {
+	node = rb_first(&obj->active_tree);
+	while (node) {
 		struct sync_pt *pt =
-			container_of(pos, struct sync_pt, active_list);
+			rb_entry(node, struct sync_pt, active_node);
+		struct rb_node *next;
 
-		if (_sync_pt_has_signaled(pt)) {
-			list_del_init(pos);
-			list_add(&pt->signaled_list, &signaled_pts);
-			kref_get(&pt->fence->kref);
-		}
+		if (!_sync_pt_has_signaled(pt))
+			break;
+
+		next = rb_next(node);
+		rb_erase(node, &obj->active_tree);
+		RB_CLEAR_NODE(node);
+		list_add_tail(&pt->signaled_list, &signaled_pts);
+		kref_get(&pt->fence->kref);
+		node = next;
 	}
 
-	spin_unlock_irqrestore(&obj->active_list_lock, flags);
+	spin_unlock_irqrestore(&obj->active_lock, flags);
 
 	list_for_each_safe(pos, n, &signaled_pts) {
 		struct sync_pt *pt =
@@ -173,7 +210,7 @@ struct sync_pt *sync_pt_create(struct sync_timeline *parent, int size)
 	if (pt == NULL)
 		return NULL;
 
-	INIT_LIST_HEAD(&pt->active_list);
+	RB_CLEAR_NODE(&pt->active_node);
 	kref_get(&parent->kref);
 	sync_timeline_add_pt(parent, pt);
 
@@ -215,22 +252,42 @@ static struct sync_pt *sync_pt_dup(struct sync_pt *pt)
 	return pt->parent->ops->dup(pt);
 }
 
+static void sync_timeline_insert_active(struct sync_timeline *obj,
+					struct sync_pt *pt)
+{
+	struct rb_node **p = &obj->active_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct sync_pt *entry;
+
+		parent = *p;
+		entry = rb_entry(parent, struct sync_pt, active_node);
+		if (obj->ops->compare(pt, entry) < 0)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&pt->active_node, parent, p);
+	rb_insert_color(&pt->active_node, &obj->active_tree);
+}
+
 static void sync_pt_activate(struct sync_pt *pt)
 {
 	struct sync_timeline *obj = pt->parent;
 	unsigned long flags;
 	int err;
 
-	spin_lock_irqsave(&obj->active_list_lock, flags);
+	spin_lock_irqsave(&obj->active_lock, flags);
 
 	err = _sync_pt_has_signaled(pt);
 	if (err != 0)
 		goto out;
 
-	list_add_tail(&pt->active_list, &obj->active_list_head);
+	sync_timeline_insert_active(obj, pt);
 
 out:
-	spin_unlock_irqrestore(&obj->active_list_lock, flags);
+	spin_unlock_irqrestore(&obj->active_lock, flags);
 }
 
 static int sync_fence_release(struct inode *inode, struct file *file);
@@ -248,7 +305,6 @@ static const struct file_operations sync_fence_fops = {
 static struct sync_fence *sync_fence_alloc(const char *name)
 {
 	struct sync_fence *fence;
-	unsigned long flags;
 
 	fence = kzalloc(sizeof(struct sync_fence), GFP_KERNEL);
 	if (fence == NULL)
@@ -268,9 +324,7 @@ static struct sync_fence *sync_fence_alloc(const char *name)
 
 	init_waitqueue_head(&fence->wq);
 
-	spin_lock_irqsave(&sync_fence_list_lock, flags);
-	list_add_tail(&fence->sync_fence_list, &sync_fence_list_head);
-	spin_unlock_irqrestore(&sync_fence_list_lock, flags);
+	sync_fence_list_add(fence);
 
 	return fence;
 
@@ -609,11 +663,8 @@ static void sync_fence_free(struct kref *kref)
 static int sync_fence_release(struct inode *inode, struct file *file)
 {
 	struct sync_fence *fence = file->private_data;
-	unsigned long flags;
 
-	spin_lock_irqsave(&sync_fence_list_lock, flags);
-	list_del(&fence->sync_fence_list);
-	spin_unlock_irqrestore(&sync_fence_list_lock, flags);
+	sync_fence_list_del(fence);
 
 	sync_fence_detach_pts(fence);
 
@@ -906,6 +957,7 @@ static int sync_debugfs_show(struct seq_file *s, void *unused)
 	}
 	spin_unlock_irqrestore(&sync_timeline_list_lock, flags);
 
+#ifdef CONFIG_SYNC_FENCE_LIST
 	seq_printf(s, "fences:\n--------------\n");
 
 	spin_lock_irqsave(&sync_fence_list_lock, flags);
@@ -917,6 +969,7 @@ static int sync_debugfs_show(struct seq_file *s, void *unused)
 		seq_printf(s, "\n");
 	}
 	spin_unlock_irqrestore(&sync_fence_list_lock, flags);
+#endif
 	return 0;
 }
 
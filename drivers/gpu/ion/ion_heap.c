@@ -20,7 +20,6 @@
 #include <linux/ion.h>
 #include <linux/kthread.h>
 #include <linux/mm.h>
-#include <linux/rtmutex.h>
 #include <linux/sched.h>
 #include <linux/scatterlist.h>
 #include <linux/vmalloc.h>
@@ -274,10 +273,13 @@ void ion_heap_free_page(struct ion_buffer *buffer, struct page *page,
 
 void ion_heap_freelist_add(struct ion_heap *heap, struct ion_buffer * buffer)
 {
-	rt_mutex_lock(&heap->lock);
-	list_add(&buffer->list, &heap->free_list);
+	spin_lock(&heap->free_lock);
+	list_add_tail(&buffer->list, &heap->free_list);
 	heap->free_list_size += buffer->size;
-	rt_mutex_unlock(&heap->lock);
+	heap->free_list_count++;
+	if (heap->free_list_size > heap->free_list_peak)
+		heap->free_list_peak = heap->free_list_size;
+	spin_unlock(&heap->free_lock);
 	wake_up(&heap->waitqueue);
 }
 
@@ -285,37 +287,49 @@ size_t ion_heap_freelist_size(struct ion_heap *heap)
 {
 	size_t size;
 
-	rt_mutex_lock(&heap->lock);
+	spin_lock(&heap->free_lock);
 	size = heap->free_list_size;
-	rt_mutex_unlock(&heap->lock);
+	spin_unlock(&heap->free_lock);
 
 	return size;
 }
 
+/*
+ * Buffers are only unlinked under free_lock and torn down after it is
+ * dropped, so that ion_heap_freelist_add() never waits for a destroy.
+ */
 static size_t _ion_heap_freelist_drain(struct ion_heap *heap, size_t size,
 				bool skip_pools)
 {
 	struct ion_buffer *buffer, *tmp;
 	size_t total_drained = 0;
+	LIST_HEAD(drained);
 
 	if (ion_heap_freelist_size(heap) == 0)
 		return 0;
 
-	rt_mutex_lock(&heap->lock);
+	spin_lock(&heap->free_lock);
 	if (size == 0)
 		size = heap->free_list_size;
 
 	list_for_each_entry_safe(buffer, tmp, &heap->free_list, list) {
 		if (total_drained >= size)
 			break;
-		list_del(&buffer->list);
+		list_move_tail(&buffer->list, &drained);
 		heap->free_list_size -= buffer->size;
+		heap->free_list_count--;
+		total_drained += buffer->size;
+	}
+	if (skip_pools)
+		heap->free_list_shrunk += total_drained;
+	spin_unlock(&heap->free_lock);
+
+	list_for_each_entry_safe(buffer, tmp, &drained, list) {
+		list_del(&buffer->list);
 		if (skip_pools)
 			buffer->flags |= ION_FLAG_FREED_FROM_SHRINKER;
-		total_drained += buffer->size;
 		ion_buffer_destroy(buffer);
 	}
-	rt_mutex_unlock(&heap->lock);
 
 	return total_drained;
 }
@@ -330,6 +344,22 @@ size_t ion_heap_freelist_drain_from_shrinker(struct ion_heap *heap, size_t size)
 	return _ion_heap_freelist_drain(heap, size, true);
 }
 
+void ion_heap_freelist_show(struct ion_heap *heap, struct seq_file *s)
+{
+	size_t size, peak, shrunk;
+	unsigned int count;
+
+	spin_lock(&heap->free_lock);
+	size = heap->free_list_size;
+	count = heap->free_list_count;
+	peak = heap->free_list_peak;
+	shrunk = heap->free_list_shrunk;
+	spin_unlock(&heap->free_lock);
+
+	seq_printf(s, "deferred free: %u buffers, %zu bytes pending, %zu peak, %zu drained by shrinker\n",
+		   count, size, peak, shrunk);
+}
+
 int ion_heap_deferred_free(void *data)
 {
 	struct ion_heap *heap = data;
@@ -338,18 +368,19 @@ int ion_heap_deferred_free(void *data)
 		struct ion_buffer *buffer;
 
 		wait_event_freezable(heap->waitqueue,
-				     ion_heap_freelist_size(heap) > 0);
+				     ACCESS_ONCE(heap->free_list_size) > 0);
 
-		rt_mutex_lock(&heap->lock);
+		spin_lock(&heap->free_lock);
 		if (list_empty(&heap->free_list)) {
-			rt_mutex_unlock(&heap->lock);
+			spin_unlock(&heap->free_lock);
 			continue;
 		}
 		buffer = list_first_entry(&heap->free_list, struct ion_buffer,
 					  list);
 		list_del(&buffer->list);
 		heap->free_list_size -= buffer->size;
-		rt_mutex_unlock(&heap->lock);
+		heap->free_list_count--;
+		spin_unlock(&heap->free_lock);
 		ion_buffer_destroy(buffer);
 	}
 
@@ -362,16 +393,19 @@ int ion_heap_init_deferred_free(struct ion_heap *heap)
 
 	INIT_LIST_HEAD(&heap->free_list);
 	heap->free_list_size = 0;
-	rt_mutex_init(&heap->lock);
+	heap->free_list_count = 0;
+	heap->free_list_peak = 0;
+	heap->free_list_shrunk = 0;
+	spin_lock_init(&heap->free_lock);
 	init_waitqueue_head(&heap->waitqueue);
 	heap->task = kthread_run(ion_heap_deferred_free, heap,
 				 "%s", heap->name);
-	sched_setscheduler(heap->task, SCHED_IDLE, &param);
 	if (IS_ERR(heap->task)) {
 		pr_err("%s: creating thread for deferred free failed\n",
 		       __func__);
 		return PTR_RET(heap->task);
 	}
+	sched_setscheduler(heap->task, SCHED_IDLE, &param);
 	return 0;
 }
 
@@ -17,39 +17,62 @@
 #include <linux/debugfs.h>
 #include <linux/dma-mapping.h>
 #include <linux/err.h>
+#include <linux/freezer.h>
 #include <linux/fs.h>
+#include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include "ion_priv.h"
 
-#define IONPOOL_MAGIC 0x1F3D5B79
+/*
+ * Pooled pages are chained through page->lru, so adding and removing them
+ * needs no allocation and only a short spinlocked section.  Order-0 pools
+ * additionally keep a small per-cpu stack of pages in front of the shared
+ * lists, accessed with interrupts off and no lock at all.
+ */
+#define ION_POOL_PCP_MAX	32
 
-struct ion_page_pool_item {
-	unsigned int guard;
-	unsigned int magic;
-	struct page *page;
-	struct list_head list;
-	unsigned long ts;
+struct ion_page_pool_pcp {
+	int count;
+	struct page *pages[ION_POOL_PCP_MAX];
 };
 
+struct ion_page_pool_drain {
+	struct ion_page_pool *pool;
+	bool high;
+	atomic_t nr_to_free;
+	atomic_t nr_freed;
+};
+
+/* pools do not refill for this long after the shrinker trimmed them */
+#define ION_POOL_REFILL_HOLDOFF	(5 * HZ)
+
+static LIST_HEAD(ion_pool_refill_list);
+static DEFINE_MUTEX(ion_pool_refill_lock);
+static DECLARE_WAIT_QUEUE_HEAD(ion_pool_refill_wq);
+static atomic_t ion_pool_refill_pending = ATOMIC_INIT(0);
+static struct task_struct *ion_pool_refill_task;
 
-static void *ion_page_pool_alloc_pages(struct ion_page_pool *pool)
+static void *ion_page_pool_alloc_pages(struct ion_page_pool *pool,
+				       gfp_t gfp_mask)
 {
 	struct page *page;
 	struct scatterlist sg;
 	const bool high_order = pool->order > 4;
 
 	if (high_order)
-		page = alloc_pages(pool->gfp_mask & ~__GFP_ZERO, pool->order);
+		page = alloc_pages(gfp_mask & ~__GFP_ZERO, pool->order);
 	else
-		page = alloc_pages(pool->gfp_mask, pool->order);
+		page = alloc_pages(gfp_mask, pool->order);
 
 	if (!page)
 		return NULL;
 
-	if ((pool->gfp_mask & __GFP_ZERO) && high_order)
+	if ((gfp_mask & __GFP_ZERO) && high_order)
 		if (ion_heap_high_order_page_zero(
 				page, pool->order, pool->should_invalidate))
 			goto error_free_pages;
@@ -73,88 +96,164 @@ static void ion_page_pool_free_pages(struct ion_page_pool *pool,
 	__free_pages(page, pool->order);
 }
 
-static int ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
+static void ion_page_pool_add(struct ion_page_pool *pool, struct page *page)
 {
-	struct ion_page_pool_item *item;
-
-	item = kmalloc(sizeof(struct ion_page_pool_item), GFP_KERNEL);
-	if (!item)
-		return -ENOMEM;
-
-	mutex_lock(&pool->mutex);
-	item->guard = 0x0;
-	item->magic = IONPOOL_MAGIC;
-	item->ts = jiffies;
-
-	item->page = page;
+	spin_lock(&pool->lock);
 	if (PageHighMem(page)) {
-		list_add_tail(&item->list, &pool->high_items);
+		list_add_tail(&page->lru, &pool->high_items);
 		pool->high_count++;
 	} else {
-		list_add_tail(&item->list, &pool->low_items);
+		list_add_tail(&page->lru, &pool->low_items);
 		pool->low_count++;
 	}
-	mutex_unlock(&pool->mutex);
-	return 0;
+	spin_unlock(&pool->lock);
 }
 
 static struct page *ion_page_pool_remove(struct ion_page_pool *pool, bool high)
 {
-	struct ion_page_pool_item *item;
 	struct page *page;
 
 	if (high) {
 		BUG_ON(!pool->high_count);
-		item = list_first_entry(&pool->high_items,
-					struct ion_page_pool_item, list);
+		page = list_first_entry(&pool->high_items, struct page, lru);
 		pool->high_count--;
 	} else {
 		BUG_ON(!pool->low_count);
-		item = list_first_entry(&pool->low_items,
-					struct ion_page_pool_item, list);
+		page = list_first_entry(&pool->low_items, struct page, lru);
 		pool->low_count--;
 	}
 
-	if (item->guard || (item->magic != IONPOOL_MAGIC)) {
-		pr_warn("[WARN] %s: possible memory corruption detected. \n", __func__);
-		pr_warn("  pool(%p)={order=%d, count=%d/%d, mask=0x%x}\n",
-			pool, pool->order, pool->high_count, pool->low_count, pool->gfp_mask);
-		pr_warn("  item(%p)={0x%x, 0x%08x, %p, %lu} was created since %d msec ago.\n",
-			item, item->guard, item->magic, item->page, item->ts,
-			jiffies_to_msecs(jiffies - item->ts));
-	}
-	list_del(&item->list);
-	page = item->page;
-	item->magic = ~IONPOOL_MAGIC;
-	kfree(item);
+	list_del(&page->lru);
 	return page;
 }
 
-void *ion_page_pool_alloc(struct ion_page_pool *pool)
+static struct page *ion_page_pool_pcp_get(struct ion_page_pool *pool)
+{
+	struct ion_page_pool_pcp *pcp;
+	struct page *page = NULL;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	pcp = this_cpu_ptr(pool->pcp);
+	if (pcp->count)
+		page = pcp->pages[--pcp->count];
+	local_irq_restore(flags);
+
+	return page;
+}
+
+static bool ion_page_pool_pcp_put(struct ion_page_pool *pool,
+				  struct page *page)
+{
+	struct ion_page_pool_pcp *pcp;
+	unsigned long flags;
+	bool ret = false;
+
+	local_irq_save(flags);
+	pcp = this_cpu_ptr(pool->pcp);
+	if (pcp->count < ION_POOL_PCP_MAX) {
+		pcp->pages[pcp->count++] = page;
+		ret = true;
+	}
+	local_irq_restore(flags);
+
+	return ret;
+}
+
+static void ion_page_pool_pcp_drain_local(void *data)
+{
+	struct ion_page_pool_drain *drain = data;
+	struct ion_page_pool *pool = drain->pool;
+	struct ion_page_pool_pcp *pcp = this_cpu_ptr(pool->pcp);
+	int i, kept = 0;
+
+	for (i = 0; i < pcp->count; i++) {
+		struct page *page = pcp->pages[i];
+
+		if ((!drain->high && PageHighMem(page)) ||
+		    atomic_dec_return(&drain->nr_to_free) < 0) {
+			pcp->pages[kept++] = page;
+			continue;
+		}
+		ion_page_pool_free_pages(pool, page);
+		atomic_inc(&drain->nr_freed);
+	}
+	pcp->count = kept;
+}
+
+int ion_page_pool_pcp_count(struct ion_page_pool *pool)
+{
+	int cpu, count = 0;
+
+	if (!pool->pcp)
+		return 0;
+
+	for_each_possible_cpu(cpu)
+		count += per_cpu_ptr(pool->pcp, cpu)->count;
+
+	return count;
+}
+
+static void ion_page_pool_kick_refill(struct ion_page_pool *pool)
+{
+	if (!pool->refill_high || !ion_pool_refill_task)
+		return;
+	if (pool->high_count + pool->low_count >= pool->refill_low)
+		return;
+
+	atomic_set(&ion_pool_refill_pending, 1);
+	wake_up(&ion_pool_refill_wq);
+}
+
+void *ion_page_pool_alloc_pooled(struct ion_page_pool *pool)
 {
 	struct page *page = NULL;
 
 	BUG_ON(!pool);
 
-	mutex_lock(&pool->mutex);
+	if (pool->pcp) {
+		page = ion_page_pool_pcp_get(pool);
+		if (page)
+			return page;
+	}
+
+	spin_lock(&pool->lock);
 	if (pool->high_count)
 		page = ion_page_pool_remove(pool, true);
 	else if (pool->low_count)
 		page = ion_page_pool_remove(pool, false);
-	mutex_unlock(&pool->mutex);
+	spin_unlock(&pool->lock);
+
+	ion_page_pool_kick_refill(pool);
+
+	return page;
+}
+
+void *ion_page_pool_alloc(struct ion_page_pool *pool)
+{
+	struct page *page = ion_page_pool_alloc_pooled(pool);
 
 	if (!page)
-		page = ion_page_pool_alloc_pages(pool);
+		page = ion_page_pool_alloc_pages(pool, pool->gfp_mask);
 	return page;
 }
 
+bool ion_page_pool_fill_one(struct ion_page_pool *pool, gfp_t gfp_mask)
+{
+	struct page *page = ion_page_pool_alloc_pages(pool, gfp_mask);
+
+	if (!page)
+		return false;
+	ion_page_pool_add(pool, page);
+	return true;
+}
+
 void ion_page_pool_free(struct ion_page_pool *pool, struct page* page)
 {
-	int ret;
+	if (pool->pcp && ion_page_pool_pcp_put(pool, page))
+		return;
 
-	ret = ion_page_pool_add(pool, page);
-	if (ret)
-		ion_page_pool_free_pages(pool, page);
+	ion_page_pool_add(pool, page);
 }
 
 static int ion_page_pool_total(struct ion_page_pool *pool, bool high)
@@ -164,6 +263,8 @@ static int ion_page_pool_total(struct ion_page_pool *pool, bool high)
 	total += high ? (pool->high_count + pool->low_count) *
 		(1 << pool->order) :
 			pool->low_count * (1 << pool->order);
+	if (high || !(pool->gfp_mask & __GFP_HIGHMEM))
+		total += ion_page_pool_pcp_count(pool) * (1 << pool->order);
 	return total;
 }
 
@@ -179,30 +280,91 @@ int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
 	if (nr_to_scan == 0)
 		return ion_page_pool_total(pool, high);
 
+	pool->last_shrink = jiffies;
+
 	for (i = 0; i < nr_to_scan; i++) {
 		struct page *page;
 
-		mutex_lock(&pool->mutex);
+		spin_lock(&pool->lock);
 		if (pool->low_count) {
 			page = ion_page_pool_remove(pool, false);
 		} else if (high && pool->high_count) {
 			page = ion_page_pool_remove(pool, true);
 		} else {
-			mutex_unlock(&pool->mutex);
+			spin_unlock(&pool->lock);
 			break;
 		}
-		mutex_unlock(&pool->mutex);
+		spin_unlock(&pool->lock);
 		ion_page_pool_free_pages(pool, page);
 		nr_freed += (1 << pool->order);
 	}
 
+	if (i < nr_to_scan && pool->pcp) {
+		struct ion_page_pool_drain drain = {
+			.pool = pool,
+			.high = high,
+		};
+
+		atomic_set(&drain.nr_to_free, nr_to_scan - i);
+		atomic_set(&drain.nr_freed, 0);
+		on_each_cpu(ion_page_pool_pcp_drain_local, &drain, 1);
+		nr_freed += atomic_read(&drain.nr_freed) << pool->order;
+	}
+
 	return nr_freed;
 }
 
+static void ion_page_pool_refill(struct ion_page_pool *pool)
+{
+	while (pool->high_count + pool->low_count < pool->refill_high) {
+		if (time_before(jiffies, pool->last_shrink +
+				ION_POOL_REFILL_HOLDOFF))
+			break;
+
+		if (!ion_page_pool_fill_one(pool, pool->gfp_mask))
+			break;
+	}
+}
+
+static int ion_page_pool_refill_thread(void *data)
+{
+	while (true) {
+		struct ion_page_pool *pool;
+
+		wait_event_freezable(ion_pool_refill_wq,
+				     atomic_read(&ion_pool_refill_pending));
+		atomic_set(&ion_pool_refill_pending, 0);
+
+		mutex_lock(&ion_pool_refill_lock);
+		list_for_each_entry(pool, &ion_pool_refill_list, refill_list)
+			ion_page_pool_refill(pool);
+		mutex_unlock(&ion_pool_refill_lock);
+	}
+
+	return 0;
+}
+
+void ion_page_pool_set_refill(struct ion_page_pool *pool, int low, int high)
+{
+	mutex_lock(&ion_pool_refill_lock);
+	pool->refill_low = low;
+	pool->refill_high = high;
+	if (high && list_empty(&pool->refill_list))
+		list_add_tail(&pool->refill_list, &ion_pool_refill_list);
+	else if (!high && !list_empty(&pool->refill_list))
+		list_del_init(&pool->refill_list);
+	mutex_unlock(&ion_pool_refill_lock);
+
+	if (high) {
+		atomic_set(&ion_pool_refill_pending, 1);
+		wake_up(&ion_pool_refill_wq);
+	}
+}
+
 struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
 	bool should_invalidate)
 {
-	struct ion_page_pool *pool = kmalloc(sizeof(struct ion_page_pool),
+	struct ion_page_pool *pool = kzalloc(sizeof(struct ion_page_pool),
 					     GFP_KERNEL);
 	if (!pool)
 		return NULL;
@@ -210,22 +372,64 @@ struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
 	pool->low_count = 0;
 	INIT_LIST_HEAD(&pool->low_items);
 	INIT_LIST_HEAD(&pool->high_items);
+	INIT_LIST_HEAD(&pool->refill_list);
 	pool->gfp_mask = gfp_mask;
 	pool->order = order;
 	pool->should_invalidate = should_invalidate;
-	mutex_init(&pool->mutex);
+	spin_lock_init(&pool->lock);
 	plist_node_init(&pool->list, order);
+	pool->last_shrink = jiffies - ION_POOL_REFILL_HOLDOFF;
+
+	if (!order) {
+		pool->pcp = alloc_percpu(struct ion_page_pool_pcp);
+		if (!pool->pcp) {
+			kfree(pool);
+			return NULL;
+		}
+	}
 
 	return pool;
 }
 
 void ion_page_pool_destroy(struct ion_page_pool *pool)
 {
+	int cpu;
+
+	ion_page_pool_set_refill(pool, 0, 0);
+
+	while (pool->high_count)
+		ion_page_pool_free_pages(pool,
+				ion_page_pool_remove(pool, true));
+	while (pool->low_count)
+		ion_page_pool_free_pages(pool,
+				ion_page_pool_remove(pool, false));
+
+	if (pool->pcp) {
+		for_each_possible_cpu(cpu) {
+			struct ion_page_pool_pcp *pcp =
+				per_cpu_ptr(pool->pcp, cpu);
+
+			while (pcp->count)
+				ion_page_pool_free_pages(pool,
+					pcp->pages[--pcp->count]);
+		}
+		free_percpu(pool->pcp);
+	}
 	kfree(pool);
 }
 
 static int __init ion_page_pool_init(void)
 {
+	struct sched_param param = { .sched_priority = 0 };
+
+	ion_pool_refill_task = kthread_run(ion_page_pool_refill_thread, NULL,
+					   "ion_pool_refill");
+	if (IS_ERR(ion_pool_refill_task)) {
+		pr_err("%s: creating pool refill thread failed\n", __func__);
+		ion_pool_refill_task = NULL;
+		return 0;
+	}
+	sched_setscheduler(ion_pool_refill_task, SCHED_IDLE, &param);
 	return 0;
 }
 
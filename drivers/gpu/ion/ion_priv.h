@@ -98,7 +98,10 @@ struct ion_heap {
 	void *priv;
 	struct list_head free_list;
 	size_t free_list_size;
-	struct rt_mutex lock;
+	unsigned int free_list_count;
+	size_t free_list_peak;
+	size_t free_list_shrunk;
+	spinlock_t free_lock;
 	wait_queue_head_t waitqueue;
 	struct task_struct *task;
 	int (*debug_show)(struct ion_heap *heap, struct seq_file *, void *);
@@ -143,6 +146,8 @@ size_t ion_heap_freelist_drain_from_shrinker(struct ion_heap *heap,
 
 size_t ion_heap_freelist_size(struct ion_heap *heap);
 
+void ion_heap_freelist_show(struct ion_heap *heap, struct seq_file *s);
+
 
 
 struct ion_heap *ion_heap_create(struct ion_platform_heap *);
@@ -165,26 +170,37 @@ void ion_carveout_free(struct ion_heap *heap, ion_phys_addr_t addr,
 #define ION_CARVEOUT_ALLOCATE_FAIL -1
 
 
+struct ion_page_pool_pcp;
+
 struct ion_page_pool {
 	int high_count;
 	int low_count;
 	struct list_head high_items;
 	struct list_head low_items;
-	struct mutex mutex;
+	spinlock_t lock;
 	gfp_t gfp_mask;
 	unsigned int order;
 	struct plist_node list;
 	bool should_invalidate;
+	struct ion_page_pool_pcp __percpu *pcp;
+	int refill_low;
+	int refill_high;
+	unsigned long last_shrink;
+	struct list_head refill_list;
 };
 
 struct ion_page_pool *ion_page_pool_create(gfp_t gfp_mask, unsigned int order,
 	bool should_invalidate);
 void ion_page_pool_destroy(struct ion_page_pool *);
 void *ion_page_pool_alloc(struct ion_page_pool *);
+void *ion_page_pool_alloc_pooled(struct ion_page_pool *);
+bool ion_page_pool_fill_one(struct ion_page_pool *pool, gfp_t gfp_mask);
 void ion_page_pool_free(struct ion_page_pool *, struct page *);
 
+int ion_page_pool_pcp_count(struct ion_page_pool *pool);
 int ion_page_pool_shrink(struct ion_page_pool *pool, gfp_t gfp_mask,
 			  int nr_to_scan);
+void ion_page_pool_set_refill(struct ion_page_pool *pool, int low, int high);
 
 int ion_walk_heaps(struct ion_client *client, int heap_id, void *data,
 			int (*f)(struct ion_heap *heap, void *data));
@@ -25,6 +25,8 @@
 #include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <linux/msm_ion.h>
 #include "ion_priv.h"
 #include <linux/dma-mapping.h>
 #include <trace/events/kmem.h>
@@ -34,13 +36,50 @@ static unsigned int high_order_gfp_flags = (GFP_HIGHUSER | __GFP_ZERO |
 					    __GFP_NO_KSWAPD) & ~__GFP_WAIT;
 static unsigned int low_order_gfp_flags  = (GFP_HIGHUSER | __GFP_ZERO |
 					 __GFP_NOWARN);
-static const unsigned int orders[] = {8, 4, 0};
-static const int num_orders = ARRAY_SIZE(orders);
-static int order_to_index(unsigned int order)
+static unsigned int compact_gfp_flags = (GFP_HIGHUSER | __GFP_ZERO |
+					 __GFP_NOWARN | __GFP_NORETRY);
+static const unsigned int default_orders[] = {8, 4, 0};
+
+#define ION_SYSTEM_HEAP_MAX_ORDERS	8
+#define ION_SYSTEM_HEAP_FAIL_BACKOFF_MS	1000
+
+struct ion_system_heap {
+	struct ion_heap heap;
+	struct ion_page_pool **uncached_pools;
+	struct ion_page_pool **cached_pools;
+	unsigned int orders[ION_SYSTEM_HEAP_MAX_ORDERS];
+	int num_orders;
+	/*
+	 * Until fail_until[i] expires, orders[i] is only served from the
+	 * pools: the page allocator recently failed it and trying again
+	 * just costs latency before falling back to a smaller order.
+	 */
+	unsigned long fail_until[ION_SYSTEM_HEAP_MAX_ORDERS];
+	unsigned long fail_backoff;
+	bool compact;
+	struct work_struct compact_work;
+	unsigned long compact_pending;
+};
+
+/*
+ * Number of entries the background thread keeps pre-zeroed in the
+ * uncached high order pools, so that camera and video allocations
+ * rarely hit the page allocator; refilling starts below half of it.
+ */
+static int uncached_refill_high(unsigned int order)
+{
+	if (order >= 8)
+		return 2;
+	if (order >= 4)
+		return 8;
+	return 0;
+}
+
+static int order_to_index(struct ion_system_heap *heap, unsigned int order)
 {
 	int i;
-	for (i = 0; i < num_orders; i++)
-		if (order == orders[i])
+	for (i = 0; i < heap->num_orders; i++)
+		if (order == heap->orders[i])
 			return i;
 	BUG();
 	return -1;
@@ -51,32 +90,65 @@ static unsigned int order_to_size(int order)
 	return PAGE_SIZE << order;
 }
 
-struct ion_system_heap {
-	struct ion_heap heap;
-	struct ion_page_pool **uncached_pools;
-	struct ion_page_pool **cached_pools;
-};
-
 struct page_info {
 	struct page *page;
 	unsigned int order;
 	struct list_head list;
 };
 
+static void ion_system_heap_compact_work(struct work_struct *work)
+{
+	struct ion_system_heap *heap = container_of(work,
+						    struct ion_system_heap,
+						    compact_work);
+	int i;
+
+	for (i = 0; i < heap->num_orders; i++) {
+		if (test_and_clear_bit(i, &heap->compact_pending) &&
+		    ion_page_pool_fill_one(heap->uncached_pools[i],
+					   compact_gfp_flags))
+			heap->fail_until[i] = jiffies;
+		if (test_and_clear_bit(i + ION_SYSTEM_HEAP_MAX_ORDERS,
+				       &heap->compact_pending) &&
+		    ion_page_pool_fill_one(heap->cached_pools[i],
+					   compact_gfp_flags))
+			heap->fail_until[i] = jiffies;
+	}
+}
+
+static void ion_system_heap_order_failed(struct ion_system_heap *heap,
+					 int index, bool cached)
+{
+	heap->fail_until[index] = jiffies + heap->fail_backoff;
+	if (!heap->compact)
+		return;
+	set_bit(cached ? index + ION_SYSTEM_HEAP_MAX_ORDERS : index,
+		&heap->compact_pending);
+	queue_work(system_unbound_wq, &heap->compact_work);
+}
+
 static struct page *alloc_buffer_page(struct ion_system_heap *heap,
 				      struct ion_buffer *buffer,
-				      unsigned long order)
+				      int index)
 {
 	bool cached = ion_buffer_cached(buffer);
 	bool split_pages = ion_buffer_fault_user_mappings(buffer);
+	unsigned int order = heap->orders[index];
 	struct page *page;
 	struct ion_page_pool *pool;
 
 	if (!cached)
-		pool = heap->uncached_pools[order_to_index(order)];
+		pool = heap->uncached_pools[index];
 	else
-		pool = heap->cached_pools[order_to_index(order)];
-	page = ion_page_pool_alloc(pool);
+		pool = heap->cached_pools[index];
+
+	if (order && time_before(jiffies, heap->fail_until[index])) {
+		page = ion_page_pool_alloc_pooled(pool);
+	} else {
+		page = ion_page_pool_alloc(pool);
+		if (!page && order)
+			ion_system_heap_order_failed(heap, index, cached);
+	}
 	if (!page)
 		return 0;
 
@@ -104,9 +176,9 @@ static void free_buffer_page(struct ion_system_heap *heap,
 	} else  {
 		struct ion_page_pool *pool;
 		if (cached)
-			pool = heap->cached_pools[order_to_index(order)];
+			pool = heap->cached_pools[order_to_index(heap, order)];
 		else
-			pool = heap->uncached_pools[order_to_index(order)];
+			pool = heap->uncached_pools[order_to_index(heap, order)];
 		ion_page_pool_free(pool, page);
 	}
 }
@@ -121,20 +193,20 @@ static struct page_info *alloc_largest_available(struct ion_system_heap *heap,
 	struct page_info *info;
 	int i;
 
-	for (i = 0; i < num_orders; i++) {
-		if (size < order_to_size(orders[i]))
+	for (i = 0; i < heap->num_orders; i++) {
+		if (size < order_to_size(heap->orders[i]))
 			continue;
-		if (max_order < orders[i])
+		if (max_order < heap->orders[i])
 			continue;
 
-		page = alloc_buffer_page(heap, buffer, orders[i]);
+		page = alloc_buffer_page(heap, buffer, i);
 		if (!page)
 			continue;
 
 		info = kmalloc(sizeof(struct page_info), GFP_KERNEL);
 		if (info) {
 			info->page = page;
-			info->order = orders[i];
+			info->order = heap->orders[i];
 		}
 		return info;
 	}
@@ -156,7 +228,7 @@ static int ion_system_heap_allocate(struct ion_heap *heap,
 	struct page_info *info, *tmp_info;
 	int i = 0;
 	unsigned long size_remaining = PAGE_ALIGN(size);
-	unsigned int max_order = orders[0];
+	unsigned int max_order = sys_heap->orders[0];
 	bool split_pages = ion_buffer_fault_user_mappings(buffer);
 
 	INIT_LIST_HEAD(&pages);
@@ -279,7 +351,7 @@ static int ion_system_heap_shrink(struct shrinker *shrinker,
 	if (nr_freed >= sc->nr_to_scan)
 		goto end;
 
-	for (i = 0; i < num_orders; i++) {
+	for (i = 0; i < sys_heap->num_orders; i++) {
 		nr_freed += ion_page_pool_shrink(sys_heap->uncached_pools[i],
 						sc->gfp_mask, sc->nr_to_scan);
 		if (nr_freed >= sc->nr_to_scan)
@@ -292,7 +364,7 @@ static int ion_system_heap_shrink(struct shrinker *shrinker,
 	}
 
 end:
-	for (i = 0; i < num_orders; i++) {
+	for (i = 0; i < sys_heap->num_orders; i++) {
 		nr_total += ion_page_pool_shrink(
 			sys_heap->uncached_pools[i], sc->gfp_mask, 0);
 		nr_total += ion_page_pool_shrink(
@@ -310,9 +382,9 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 	struct ion_system_heap *sys_heap = container_of(heap,
 							struct ion_system_heap,
 							heap);
-	int i;
+	int i, pcp_count;
 	unsigned long total_pages = 0;
-	for (i = 0; i < num_orders; i++) {
+	for (i = 0; i < sys_heap->num_orders; i++) {
 		struct ion_page_pool *pool = sys_heap->uncached_pools[i];
 		seq_printf(s,
 			"%d order %u highmem pages in uncached pool = %lu total\n",
@@ -322,10 +394,16 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 			"%d order %u lowmem pages in uncached pool = %lu total\n",
 			pool->low_count, pool->order,
 			(1 << pool->order) * PAGE_SIZE * pool->low_count);
-		total_pages += (1 << pool->order) * (pool->high_count + pool->low_count);
+		pcp_count = ion_page_pool_pcp_count(pool);
+		seq_printf(s,
+			"%d order %u pages in uncached per-cpu caches = %lu total\n",
+			pcp_count, pool->order,
+			(1 << pool->order) * PAGE_SIZE * pcp_count);
+		total_pages += (1 << pool->order) *
+			(pool->high_count + pool->low_count + pcp_count);
 	}
 
-	for (i = 0; i < num_orders; i++) {
+	for (i = 0; i < sys_heap->num_orders; i++) {
 		struct ion_page_pool *pool = sys_heap->cached_pools[i];
 		seq_printf(s,
 			"%d order %u highmem pages in cached pool = %lu total\n",
@@ -335,7 +413,13 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 			"%d order %u lowmem pages in cached pool = %lu total\n",
 			pool->low_count, pool->order,
 			(1 << pool->order) * PAGE_SIZE * pool->low_count);
-		total_pages += (1 << pool->order) * (pool->high_count + pool->low_count);
+		pcp_count = ion_page_pool_pcp_count(pool);
+		seq_printf(s,
+			"%d order %u pages in cached per-cpu caches = %lu total\n",
+			pcp_count, pool->order,
+			(1 << pool->order) * PAGE_SIZE * pcp_count);
+		total_pages += (1 << pool->order) *
+			(pool->high_count + pool->low_count + pcp_count);
 	}
 
 	seq_printf(s,
@@ -347,25 +431,27 @@ static int ion_system_heap_debug_show(struct ion_heap *heap, struct seq_file *s,
 }
 
 
-static void ion_system_heap_destroy_pools(struct ion_page_pool **pools)
+static void ion_system_heap_destroy_pools(struct ion_system_heap *heap,
+					  struct ion_page_pool **pools)
 {
 	int i;
-	for (i = 0; i < num_orders; i++)
+	for (i = 0; i < heap->num_orders; i++)
 		if (pools[i])
 			ion_page_pool_destroy(pools[i]);
 }
 
-static int ion_system_heap_create_pools(struct ion_page_pool **pools,
+static int ion_system_heap_create_pools(struct ion_system_heap *heap,
+					struct ion_page_pool **pools,
 					bool should_invalidate)
 {
 	int i;
-	for (i = 0; i < num_orders; i++) {
+	for (i = 0; i < heap->num_orders; i++) {
 		struct ion_page_pool *pool;
 		gfp_t gfp_flags = low_order_gfp_flags;
 
-		if (orders[i])
+		if (heap->orders[i])
 			gfp_flags = high_order_gfp_flags;
-		pool = ion_page_pool_create(gfp_flags, orders[i],
+		pool = ion_page_pool_create(gfp_flags, heap->orders[i],
 					should_invalidate);
 		if (!pool)
 			goto err_create_pool;
@@ -373,14 +459,65 @@ static int ion_system_heap_create_pools(struct ion_page_pool **pools,
 	}
 	return 0;
 err_create_pool:
-	ion_system_heap_destroy_pools(pools);
+	ion_system_heap_destroy_pools(heap, pools);
 	return 1;
 }
 
-struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
+static bool ion_system_heap_orders_valid(const unsigned int *orders,
+					 int num_orders)
+{
+	int i;
+
+	if (!orders || num_orders <= 0 ||
+	    num_orders > ION_SYSTEM_HEAP_MAX_ORDERS)
+		return false;
+	for (i = 0; i < num_orders; i++) {
+		if (orders[i] >= MAX_ORDER)
+			return false;
+		if (i && orders[i] >= orders[i - 1])
+			return false;
+	}
+	return orders[num_orders - 1] == 0;
+}
+
+static void ion_system_heap_setup_orders(struct ion_system_heap *heap,
+					 struct ion_platform_heap *heap_data)
+{
+	struct ion_system_heap_pdata *pdata = NULL;
+	const unsigned int *orders = default_orders;
+	int num_orders = ARRAY_SIZE(default_orders);
+	unsigned int backoff_ms = ION_SYSTEM_HEAP_FAIL_BACKOFF_MS;
+	int i;
+
+	if (heap_data)
+		pdata = heap_data->extra_data;
+	if (pdata) {
+		if (ion_system_heap_orders_valid(pdata->orders,
+						 pdata->num_orders)) {
+			orders = pdata->orders;
+			num_orders = pdata->num_orders;
+		} else if (pdata->orders) {
+			pr_warn("%s: invalid order list for heap %s, using defaults\n",
+				__func__, heap_data->name);
+		}
+		if (pdata->fail_backoff_ms)
+			backoff_ms = pdata->fail_backoff_ms;
+		heap->compact = pdata->compact_on_fail;
+	}
+
+	heap->num_orders = num_orders;
+	for (i = 0; i < num_orders; i++) {
+		heap->orders[i] = orders[i];
+		heap->fail_until[i] = jiffies;
+	}
+	heap->fail_backoff = msecs_to_jiffies(backoff_ms);
+}
+
+struct ion_heap *ion_system_heap_create(struct ion_platform_heap *heap_data)
 {
 	struct ion_system_heap *heap;
-	int pools_size = sizeof(struct ion_page_pool *) * num_orders;
+	int pools_size;
+	int i;
 
 	heap = kzalloc(sizeof(struct ion_system_heap), GFP_KERNEL);
 	if (!heap)
@@ -388,6 +525,9 @@ struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 	heap->heap.ops = &system_heap_ops;
 	heap->heap.type = ION_HEAP_TYPE_SYSTEM;
 	heap->heap.flags = ION_HEAP_FLAG_DEFER_FREE;
+	ion_system_heap_setup_orders(heap, heap_data);
+	INIT_WORK(&heap->compact_work, ion_system_heap_compact_work);
+	pools_size = sizeof(struct ion_page_pool *) * heap->num_orders;
 
 	heap->uncached_pools = kzalloc(pools_size, GFP_KERNEL);
 	if (!heap->uncached_pools)
@@ -397,12 +537,20 @@ struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 	if (!heap->cached_pools)
 		goto err_alloc_cached_pools;
 
-	if (ion_system_heap_create_pools(heap->uncached_pools, false))
+	if (ion_system_heap_create_pools(heap, heap->uncached_pools, false))
 		goto err_create_uncached_pools;
 
-	if (ion_system_heap_create_pools(heap->cached_pools, true))
+	if (ion_system_heap_create_pools(heap, heap->cached_pools, true))
 		goto err_create_cached_pools;
 
+	for (i = 0; i < heap->num_orders; i++) {
+		int high = uncached_refill_high(heap->orders[i]);
+
+		if (high)
+			ion_page_pool_set_refill(heap->uncached_pools[i],
+						 high / 2, high);
+	}
+
 	heap->heap.shrinker.shrink = ion_system_heap_shrink;
 	heap->heap.shrinker.seeks = DEFAULT_SEEKS;
 	heap->heap.shrinker.batch = 0;
@@ -411,7 +559,7 @@ struct ion_heap *ion_system_heap_create(struct ion_platform_heap *unused)
 	return &heap->heap;
 
 err_create_cached_pools:
-	ion_system_heap_destroy_pools(heap->uncached_pools);
+	ion_system_heap_destroy_pools(heap, heap->uncached_pools);
 err_create_uncached_pools:
 	kfree(heap->cached_pools);
 err_alloc_cached_pools:
@@ -427,8 +575,9 @@ void ion_system_heap_destroy(struct ion_heap *heap)
 							struct ion_system_heap,
 							heap);
 
-	ion_system_heap_destroy_pools(sys_heap->uncached_pools);
-	ion_system_heap_destroy_pools(sys_heap->cached_pools);
+	cancel_work_sync(&sys_heap->compact_work);
+	ion_system_heap_destroy_pools(sys_heap, sys_heap->uncached_pools);
+	ion_system_heap_destroy_pools(sys_heap, sys_heap->cached_pools);
 	kfree(sys_heap->uncached_pools);
 	kfree(sys_heap->cached_pools);
 	kfree(sys_heap);
@@ -0,0 +1,862 @@
+/* binder_alloc.c
+ *
+ * Android IPC Subsystem
+ *
+ * Copyright (C) 2007-2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <asm/cacheflush.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/rbtree.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/shrinker.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+
+#include "binder_alloc.h"
+
+#define BINDER_MAP_BATCH 16
+
+enum {
+	BINDER_DEBUG_USER_ERROR             = 1U << 0,
+	BINDER_DEBUG_OPEN_CLOSE             = 1U << 1,
+	BINDER_DEBUG_BUFFER_ALLOC           = 1U << 2,
+	BINDER_DEBUG_BUFFER_ALLOC_ASYNC     = 1U << 3,
+	BINDER_DEBUG_SHRINKER               = 1U << 4,
+};
+static uint32_t binder_alloc_debug_mask = BINDER_DEBUG_USER_ERROR;
+module_param_named(debug_mask, binder_alloc_debug_mask,
+		   uint, S_IWUSR | S_IRUGO);
+
+#define binder_alloc_debug(mask, x...) \
+	do { \
+		if (binder_alloc_debug_mask & mask) \
+			printk(KERN_INFO x); \
+	} while (0)
+
+static DEFINE_MUTEX(binder_alloc_mmap_lock);
+
+static LIST_HEAD(binder_alloc_lru);
+static DEFINE_SPINLOCK(binder_alloc_lru_lock);
+static int binder_alloc_lru_count;
+
+static size_t binder_alloc_buffer_size(struct binder_alloc *alloc,
+				       struct binder_buffer *buffer)
+{
+	if (list_is_last(&buffer->entry, &alloc->buffers))
+		return alloc->buffer + alloc->buffer_size - (void *)buffer->data;
+	else
+		return (size_t)list_entry(buffer->entry.next,
+			struct binder_buffer, entry) - (size_t)buffer->data;
+}
+
+static void binder_insert_free_buffer(struct binder_alloc *alloc,
+				      struct binder_buffer *new_buffer)
+{
+	struct rb_node **p = &alloc->free_buffers.rb_node;
+	struct rb_node *parent = NULL;
+	struct binder_buffer *buffer;
+	size_t buffer_size;
+	size_t new_buffer_size;
+
+	BUG_ON(!new_buffer->free);
+
+	new_buffer_size = binder_alloc_buffer_size(alloc, new_buffer);
+
+	binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: add free buffer, size %zd, "
+		     "at %p\n", alloc->pid, new_buffer_size, new_buffer);
+
+	while (*p) {
+		parent = *p;
+		buffer = rb_entry(parent, struct binder_buffer, rb_node);
+		BUG_ON(!buffer->free);
+
+		buffer_size = binder_alloc_buffer_size(alloc, buffer);
+
+		if (new_buffer_size < buffer_size)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&new_buffer->rb_node, parent, p);
+	rb_insert_color(&new_buffer->rb_node, &alloc->free_buffers);
+}
+
+static void binder_insert_allocated_buffer(struct binder_alloc *alloc,
+					   struct binder_buffer *new_buffer)
+{
+	struct rb_node **p = &alloc->allocated_buffers.rb_node;
+	struct rb_node *parent = NULL;
+	struct binder_buffer *buffer;
+
+	BUG_ON(new_buffer->free);
+
+	while (*p) {
+		parent = *p;
+		buffer = rb_entry(parent, struct binder_buffer, rb_node);
+		BUG_ON(buffer->free);
+
+		if (new_buffer < buffer)
+			p = &parent->rb_left;
+		else if (new_buffer > buffer)
+			p = &parent->rb_right;
+		else
+			BUG();
+	}
+	rb_link_node(&new_buffer->rb_node, parent, p);
+	rb_insert_color(&new_buffer->rb_node, &alloc->allocated_buffers);
+}
+
+static struct binder_buffer *binder_alloc_buffer_lookup(
+		struct binder_alloc *alloc, void __user *user_ptr)
+{
+	struct rb_node *n = alloc->allocated_buffers.rb_node;
+	struct binder_buffer *buffer;
+	struct binder_buffer *kern_ptr;
+
+	kern_ptr = user_ptr - alloc->user_buffer_offset
+		- offsetof(struct binder_buffer, data);
+
+	while (n) {
+		buffer = rb_entry(n, struct binder_buffer, rb_node);
+		BUG_ON(buffer->free);
+
+		if (kern_ptr < buffer)
+			n = n->rb_left;
+		else if (kern_ptr > buffer)
+			n = n->rb_right;
+		else
+			return buffer;
+	}
+	return NULL;
+}
+
+static struct binder_lru_page *binder_alloc_page(struct binder_alloc *alloc,
+						 void *page_addr)
+{
+	return &alloc->pages[(page_addr - alloc->buffer) / PAGE_SIZE];
+}
+
+static void binder_lru_add_range(struct binder_alloc *alloc,
+				 void *start, void *end)
+{
+	struct binder_lru_page *page;
+	void *page_addr;
+
+	spin_lock(&binder_alloc_lru_lock);
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = binder_alloc_page(alloc, page_addr);
+		if (page->page_ptr && list_empty(&page->lru)) {
+			list_add_tail(&page->lru, &binder_alloc_lru);
+			binder_alloc_lru_count++;
+		}
+	}
+	spin_unlock(&binder_alloc_lru_lock);
+}
+
+static int binder_update_page_range(struct binder_alloc *alloc, int allocate,
+				    void *start, void *end,
+				    struct vm_area_struct *vma)
+{
+	void *page_addr;
+	void *batch_start;
+	struct page *batch[BINDER_MAP_BATCH];
+	struct binder_lru_page *page;
+	struct mm_struct *mm = NULL;
+	int need_map = 0;
+	int nr = 0;
+	int i = 0;
+
+	binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: %s pages %p-%p\n", alloc->pid,
+		     allocate ? "allocate" : "free", start, end);
+
+	if (end <= start)
+		return 0;
+
+	if (allocate == 0) {
+		binder_lru_add_range(alloc, start, end);
+		return 0;
+	}
+
+	spin_lock(&binder_alloc_lru_lock);
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = binder_alloc_page(alloc, page_addr);
+		if (!page->page_ptr) {
+			need_map = 1;
+			continue;
+		}
+		if (!list_empty(&page->lru)) {
+			list_del_init(&page->lru);
+			binder_alloc_lru_count--;
+		}
+	}
+	spin_unlock(&binder_alloc_lru_lock);
+	if (!need_map)
+		return 0;
+
+	if (vma == NULL)
+		mm = get_task_mm(alloc->tsk);
+
+	if (mm) {
+		down_write(&mm->mmap_sem);
+		vma = alloc->vma;
+		if (vma && mm != alloc->vma_vm_mm) {
+			pr_err("binder: %d: vma mm and task mm mismatch\n",
+				alloc->pid);
+			vma = NULL;
+		}
+	}
+
+	if (vma == NULL) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
+			     "map pages in userspace, no vma\n", alloc->pid);
+		goto err_no_vma;
+	}
+
+	page_addr = start;
+	while (page_addr < end) {
+		struct page **batch_ptr = batch;
+		struct vm_struct tmp_area;
+		int ret;
+
+		nr = 0;
+		batch_start = page_addr;
+		while (page_addr < end && nr < BINDER_MAP_BATCH) {
+			page = binder_alloc_page(alloc, page_addr);
+			if (page->page_ptr) {
+				if (nr)
+					break;
+				page_addr += PAGE_SIZE;
+				batch_start = page_addr;
+				continue;
+			}
+			batch[nr] = alloc_page(GFP_KERNEL | __GFP_ZERO);
+			if (batch[nr] == NULL) {
+				printk(KERN_INFO "binder: %d: binder_alloc_buf "
+				       "failed for page at %p\n",
+				       alloc->pid, page_addr);
+				goto err_alloc_page_failed;
+			}
+			nr++;
+			page_addr += PAGE_SIZE;
+		}
+		if (nr == 0)
+			continue;
+
+		tmp_area.addr = batch_start;
+		tmp_area.size = (nr + 1) * PAGE_SIZE;
+		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &batch_ptr);
+		if (ret) {
+			printk(KERN_INFO "binder: %d: binder_alloc_buf failed "
+			       "to map pages at %p in kernel\n",
+			       alloc->pid, batch_start);
+			goto err_map_kernel_failed;
+		}
+		for (i = 0; i < nr; i++) {
+			unsigned long user_page_addr =
+				(uintptr_t)batch_start + i * PAGE_SIZE +
+				alloc->user_buffer_offset;
+
+			ret = vm_insert_page(vma, user_page_addr, batch[i]);
+			if (ret) {
+				printk(KERN_INFO "binder: %d: binder_alloc_buf "
+				       "failed to map page at %lx in "
+				       "userspace\n", alloc->pid,
+				       user_page_addr);
+				goto err_vm_insert_page_failed;
+			}
+		}
+		for (i = 0; i < nr; i++) {
+			page = binder_alloc_page(alloc,
+						 batch_start + i * PAGE_SIZE);
+			page->page_ptr = batch[i];
+		}
+	}
+	if (mm) {
+		up_write(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return 0;
+
+err_vm_insert_page_failed:
+	if (i)
+		zap_page_range(vma, (uintptr_t)batch_start +
+			       alloc->user_buffer_offset, i * PAGE_SIZE, NULL);
+err_map_kernel_failed:
+	unmap_kernel_range((unsigned long)batch_start, nr * PAGE_SIZE);
+err_alloc_page_failed:
+	while (nr--)
+		__free_page(batch[nr]);
+err_no_vma:
+	binder_lru_add_range(alloc, start, end);
+	if (mm) {
+		up_write(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return -ENOMEM;
+}
+
+static struct binder_buffer *binder_alloc_new_buf_locked(
+		struct binder_alloc *alloc, size_t data_size,
+		size_t offsets_size, int is_async)
+{
+	struct rb_node *n = alloc->free_buffers.rb_node;
+	struct binder_buffer *buffer;
+	size_t buffer_size;
+	struct rb_node *best_fit = NULL;
+	void *has_page_addr;
+	void *end_page_addr;
+	size_t size;
+
+	if (alloc->vma == NULL) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf, no vma\n",
+			     alloc->pid);
+		return NULL;
+	}
+
+	size = ALIGN(data_size, sizeof(void *)) +
+		ALIGN(offsets_size, sizeof(void *));
+
+	if (size < data_size || size < offsets_size) {
+		binder_alloc_debug(BINDER_DEBUG_USER_ERROR,
+			"binder: %d: got transaction with invalid "
+			"size %zd-%zd\n", alloc->pid, data_size, offsets_size);
+		return NULL;
+	}
+
+	if (is_async &&
+	    alloc->free_async_space < size + sizeof(struct binder_buffer)) {
+		printk(KERN_INFO "binder: %d: binder_alloc_buf size %zd"
+			     "failed, no async space left\n", alloc->pid, size);
+		return NULL;
+	}
+
+	while (n) {
+		buffer = rb_entry(n, struct binder_buffer, rb_node);
+		BUG_ON(!buffer->free);
+		buffer_size = binder_alloc_buffer_size(alloc, buffer);
+
+		if (size < buffer_size) {
+			best_fit = n;
+			n = n->rb_left;
+		} else if (size > buffer_size)
+			n = n->rb_right;
+		else {
+			best_fit = n;
+			break;
+		}
+	}
+	if (best_fit == NULL) {
+		printk(KERN_INFO "binder: %d: binder_alloc_buf size %zd failed, "
+			     "no address space\n", alloc->pid, size);
+		return NULL;
+	}
+	if (n == NULL) {
+		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
+		buffer_size = binder_alloc_buffer_size(alloc, buffer);
+	}
+
+	binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: binder_alloc_buf size %zd got buff"
+		     "er %p size %zd\n", alloc->pid, size, buffer, buffer_size);
+
+	has_page_addr =
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
+	if (n == NULL) {
+		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
+			buffer_size = size;
+		else
+			buffer_size = size + sizeof(struct binder_buffer);
+	}
+	end_page_addr =
+		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
+	if (end_page_addr > has_page_addr)
+		end_page_addr = has_page_addr;
+	if (binder_update_page_range(alloc, 1,
+	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
+		return NULL;
+
+	rb_erase(best_fit, &alloc->free_buffers);
+	buffer->free = 0;
+	binder_insert_allocated_buffer(alloc, buffer);
+	if (buffer_size != size) {
+		struct binder_buffer *new_buffer = (void *)buffer->data + size;
+		list_add(&new_buffer->entry, &buffer->entry);
+		new_buffer->free = 1;
+		binder_insert_free_buffer(alloc, new_buffer);
+	}
+	binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: binder_alloc_buf size %zd got "
+		     "%p\n", alloc->pid, size, buffer);
+	buffer->data_size = data_size;
+	buffer->offsets_size = offsets_size;
+	buffer->async_transaction = is_async;
+	alloc->allocated_size += size + sizeof(struct binder_buffer);
+	if (alloc->allocated_size > alloc->allocated_size_max)
+		alloc->allocated_size_max = alloc->allocated_size;
+	if (is_async) {
+		alloc->free_async_space -= size + sizeof(struct binder_buffer);
+		binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
+			     "binder: %d: binder_alloc_buf size %zd "
+			     "async free %zd\n", alloc->pid, size,
+			     alloc->free_async_space);
+	}
+
+	return buffer;
+}
+
+struct binder_buffer *binder_alloc_new_buf(struct binder_alloc *alloc,
+					   size_t data_size,
+					   size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&alloc->mutex);
+	buffer = binder_alloc_new_buf_locked(alloc, data_size, offsets_size,
+					     is_async);
+	mutex_unlock(&alloc->mutex);
+	return buffer;
+}
+
+static void *buffer_start_page(struct binder_buffer *buffer)
+{
+	return (void *)((uintptr_t)buffer & PAGE_MASK);
+}
+
+static void *buffer_end_page(struct binder_buffer *buffer)
+{
+	return (void *)(((uintptr_t)(buffer + 1) - 1) & PAGE_MASK);
+}
+
+static void binder_delete_free_buffer(struct binder_alloc *alloc,
+				      struct binder_buffer *buffer)
+{
+	struct binder_buffer *prev, *next = NULL;
+	int free_page_end = 1;
+	int free_page_start = 1;
+
+	BUG_ON(alloc->buffers.next == &buffer->entry);
+	prev = list_entry(buffer->entry.prev, struct binder_buffer, entry);
+	BUG_ON(!prev->free);
+	if (buffer_end_page(prev) == buffer_start_page(buffer)) {
+		free_page_start = 0;
+		if (buffer_end_page(prev) == buffer_end_page(buffer))
+			free_page_end = 0;
+		binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+			     "binder: %d: merge free, buffer %p "
+			     "share page with %p\n", alloc->pid, buffer, prev);
+	}
+
+	if (!list_is_last(&buffer->entry, &alloc->buffers)) {
+		next = list_entry(buffer->entry.next,
+				  struct binder_buffer, entry);
+		if (buffer_start_page(next) == buffer_end_page(buffer)) {
+			free_page_end = 0;
+			if (buffer_start_page(next) ==
+			    buffer_start_page(buffer))
+				free_page_start = 0;
+			binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+				     "binder: %d: merge free, buffer"
+				     " %p share page with %p\n", alloc->pid,
+				     buffer, prev);
+		}
+	}
+	list_del(&buffer->entry);
+	if (free_page_start || free_page_end) {
+		binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+			     "binder: %d: merge free, buffer %p do "
+			     "not share page%s%s with with %p or %p\n",
+			     alloc->pid, buffer, free_page_start ? "" : " end",
+			     free_page_end ? "" : " start", prev, next);
+		binder_update_page_range(alloc, 0, free_page_start ?
+			buffer_start_page(buffer) : buffer_end_page(buffer),
+			(free_page_end ? buffer_end_page(buffer) :
+			buffer_start_page(buffer)) + PAGE_SIZE, NULL);
+	}
+}
+
+static void binder_free_buf_locked(struct binder_alloc *alloc,
+				   struct binder_buffer *buffer)
+{
+	size_t size, buffer_size;
+
+	buffer_size = binder_alloc_buffer_size(alloc, buffer);
+
+	size = ALIGN(buffer->data_size, sizeof(void *)) +
+		ALIGN(buffer->offsets_size, sizeof(void *));
+
+	binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+		     "binder: %d: binder_free_buf %p size %zd buffer"
+		     "_size %zd\n", alloc->pid, buffer, size, buffer_size);
+
+	BUG_ON(buffer->free);
+	BUG_ON(size > buffer_size);
+	BUG_ON(buffer->transaction != NULL);
+	BUG_ON((void *)buffer < alloc->buffer);
+	BUG_ON((void *)buffer > alloc->buffer + alloc->buffer_size);
+
+	alloc->allocated_size -= size + sizeof(struct binder_buffer);
+	if (buffer->async_transaction) {
+		alloc->free_async_space += size + sizeof(struct binder_buffer);
+
+		binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
+			     "binder: %d: binder_free_buf size %zd "
+			     "async free %zd\n", alloc->pid, size,
+			     alloc->free_async_space);
+	}
+
+	binder_update_page_range(alloc, 0,
+		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
+		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
+		NULL);
+	rb_erase(&buffer->rb_node, &alloc->allocated_buffers);
+	buffer->free = 1;
+	if (!list_is_last(&buffer->entry, &alloc->buffers)) {
+		struct binder_buffer *next = list_entry(buffer->entry.next,
+						struct binder_buffer, entry);
+		if (next->free) {
+			rb_erase(&next->rb_node, &alloc->free_buffers);
+			binder_delete_free_buffer(alloc, next);
+		}
+	}
+	if (alloc->buffers.next != &buffer->entry) {
+		struct binder_buffer *prev = list_entry(buffer->entry.prev,
+						struct binder_buffer, entry);
+		if (prev->free) {
+			binder_delete_free_buffer(alloc, buffer);
+			rb_erase(&prev->rb_node, &alloc->free_buffers);
+			buffer = prev;
+		}
+	}
+	binder_insert_free_buffer(alloc, buffer);
+}
+
+void binder_alloc_free_buf(struct binder_alloc *alloc,
+			   struct binder_buffer *buffer)
+{
+	mutex_lock(&alloc->mutex);
+	binder_free_buf_locked(alloc, buffer);
+	mutex_unlock(&alloc->mutex);
+}
+
+struct binder_buffer *binder_alloc_prepare_to_free(struct binder_alloc *alloc,
+						   void __user *user_ptr)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&alloc->mutex);
+	buffer = binder_alloc_buffer_lookup(alloc, user_ptr);
+	if (buffer) {
+		if (!buffer->allow_user_free)
+			buffer = ERR_PTR(-EPERM);
+		else
+			buffer->allow_user_free = 0;
+	}
+	mutex_unlock(&alloc->mutex);
+	return buffer;
+}
+
+int binder_alloc_mmap_handler(struct binder_alloc *alloc,
+			      struct vm_area_struct *vma)
+{
+	int ret;
+	int i;
+	struct vm_struct *area;
+	const char *failure_string;
+	struct binder_buffer *buffer;
+
+	mutex_lock(&binder_alloc_mmap_lock);
+	if (alloc->buffer) {
+		ret = -EBUSY;
+		failure_string = "already mapped";
+		goto err_already_mapped;
+	}
+
+	area = get_vm_area(vma->vm_end - vma->vm_start, VM_IOREMAP);
+	if (area == NULL) {
+		ret = -ENOMEM;
+		failure_string = "get_vm_area";
+		goto err_get_vm_area_failed;
+	}
+	alloc->buffer = area->addr;
+	alloc->user_buffer_offset = vma->vm_start - (uintptr_t)alloc->buffer;
+	mutex_unlock(&binder_alloc_mmap_lock);
+
+#ifdef CONFIG_CPU_CACHE_VIPT
+	if (cache_is_vipt_aliasing()) {
+		while (CACHE_COLOUR((vma->vm_start ^ (uint32_t)alloc->buffer))) {
+			printk(KERN_INFO "binder_mmap: %d %lx-%lx maps %p bad alignment\n", alloc->pid, vma->vm_start, vma->vm_end, alloc->buffer);
+			vma->vm_start += PAGE_SIZE;
+		}
+	}
+#endif
+	alloc->buffer_size = vma->vm_end - vma->vm_start;
+	alloc->pages = kzalloc(sizeof(alloc->pages[0]) *
+			       (alloc->buffer_size / PAGE_SIZE), GFP_KERNEL);
+	if (alloc->pages == NULL) {
+		ret = -ENOMEM;
+		failure_string = "alloc page array";
+		goto err_alloc_pages_failed;
+	}
+	for (i = 0; i < alloc->buffer_size / PAGE_SIZE; i++) {
+		INIT_LIST_HEAD(&alloc->pages[i].lru);
+		alloc->pages[i].alloc = alloc;
+	}
+
+	if (binder_update_page_range(alloc, 1, alloc->buffer,
+				     alloc->buffer + PAGE_SIZE, vma)) {
+		ret = -ENOMEM;
+		failure_string = "alloc small buf";
+		goto err_alloc_small_buf_failed;
+	}
+	buffer = alloc->buffer;
+	INIT_LIST_HEAD(&alloc->buffers);
+	list_add(&buffer->entry, &alloc->buffers);
+	buffer->free = 1;
+	binder_insert_free_buffer(alloc, buffer);
+	alloc->free_async_space = alloc->buffer_size / 2;
+	barrier();
+	alloc->vma = vma;
+	alloc->vma_vm_mm = vma->vm_mm;
+	atomic_inc(&alloc->vma_vm_mm->mm_count);
+
+	return 0;
+
+err_alloc_small_buf_failed:
+	kfree(alloc->pages);
+	alloc->pages = NULL;
+err_alloc_pages_failed:
+	mutex_lock(&binder_alloc_mmap_lock);
+	vfree(alloc->buffer);
+	alloc->buffer = NULL;
+err_get_vm_area_failed:
+err_already_mapped:
+	mutex_unlock(&binder_alloc_mmap_lock);
+	printk(KERN_INFO "binder_mmap: %d %lx-%lx %s failed %d\n",
+		     alloc->pid, vma->vm_start, vma->vm_end, failure_string,
+		     ret);
+	return ret;
+}
+
+void binder_alloc_vma_close(struct binder_alloc *alloc)
+{
+	alloc->vma = NULL;
+}
+
+void binder_alloc_deferred_release(struct binder_alloc *alloc)
+{
+	struct rb_node *n;
+	int buffers, page_count;
+
+	BUG_ON(alloc->vma);
+
+	buffers = 0;
+	mutex_lock(&alloc->mutex);
+	while ((n = rb_first(&alloc->allocated_buffers))) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
+							rb_node);
+		binder_free_buf_locked(alloc, buffer);
+		buffers++;
+	}
+
+	page_count = 0;
+	if (alloc->pages) {
+		int i;
+
+		for (i = 0; i < alloc->buffer_size / PAGE_SIZE; i++) {
+			struct binder_lru_page *page = &alloc->pages[i];
+			void *page_addr;
+
+			if (!page->page_ptr)
+				continue;
+
+			spin_lock(&binder_alloc_lru_lock);
+			if (!list_empty(&page->lru)) {
+				list_del_init(&page->lru);
+				binder_alloc_lru_count--;
+			}
+			spin_unlock(&binder_alloc_lru_lock);
+
+			page_addr = alloc->buffer + i * PAGE_SIZE;
+			binder_alloc_debug(BINDER_DEBUG_BUFFER_ALLOC,
+				     "binder_release: %d: "
+				     "page %d at %p not freed\n",
+				     alloc->pid, i, page_addr);
+			unmap_kernel_range((unsigned long)page_addr,
+				PAGE_SIZE);
+			__free_page(page->page_ptr);
+			page->page_ptr = NULL;
+			page_count++;
+		}
+		kfree(alloc->pages);
+		vfree(alloc->buffer);
+	}
+	mutex_unlock(&alloc->mutex);
+	if (alloc->vma_vm_mm)
+		mmdrop(alloc->vma_vm_mm);
+
+	binder_alloc_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d buffers %d, pages %d\n",
+		     alloc->pid, buffers, page_count);
+}
+
+int binder_alloc_get_allocated_count(struct binder_alloc *alloc)
+{
+	struct rb_node *n;
+	int count = 0;
+
+	mutex_lock(&alloc->mutex);
+	for (n = rb_first(&alloc->allocated_buffers); n != NULL; n = rb_next(n))
+		count++;
+	mutex_unlock(&alloc->mutex);
+	return count;
+}
+
+void binder_alloc_print_allocated(struct seq_file *m,
+				  struct binder_alloc *alloc)
+{
+	struct rb_node *n;
+
+	mutex_lock(&alloc->mutex);
+	for (n = rb_first(&alloc->allocated_buffers); n != NULL; n = rb_next(n)) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
+							rb_node);
+		seq_printf(m, "  buffer %d: %p size %zd:%zd %s\n",
+			   buffer->debug_id, buffer->data,
+			   buffer->data_size, buffer->offsets_size,
+			   buffer->transaction ? "active" : "delivered");
+	}
+	mutex_unlock(&alloc->mutex);
+}
+
+void binder_alloc_print_stats(struct seq_file *m,
+			      struct binder_alloc *alloc)
+{
+	int active = 0;
+	int lru = 0;
+	int free = 0;
+	size_t allocated_size;
+	size_t allocated_size_max;
+	int i;
+
+	mutex_lock(&alloc->mutex);
+	allocated_size = alloc->allocated_size;
+	allocated_size_max = alloc->allocated_size_max;
+	if (alloc->pages) {
+		spin_lock(&binder_alloc_lru_lock);
+		for (i = 0; i < alloc->buffer_size / PAGE_SIZE; i++) {
+			struct binder_lru_page *page = &alloc->pages[i];
+
+			if (!page->page_ptr)
+				free++;
+			else if (list_empty(&page->lru))
+				active++;
+			else
+				lru++;
+		}
+		spin_unlock(&binder_alloc_lru_lock);
+	}
+	mutex_unlock(&alloc->mutex);
+	seq_printf(m, "  pages: %d:%d:%d\n", active, lru, free);
+	seq_printf(m, "  buffer space: %zd used, %zd high water, %zd total\n",
+		   allocated_size, allocated_size_max, alloc->buffer_size);
+}
+
+static int binder_alloc_shrink(struct shrinker *shrink,
+			       struct shrink_control *sc)
+{
+	struct binder_lru_page *page;
+	unsigned long nr_to_scan = sc->nr_to_scan;
+	int freed = 0;
+	int count;
+
+	spin_lock(&binder_alloc_lru_lock);
+	while (nr_to_scan && !list_empty(&binder_alloc_lru)) {
+		struct binder_alloc *alloc;
+		struct mm_struct *mm;
+		void *page_addr;
+
+		nr_to_scan--;
+		page = list_first_entry(&binder_alloc_lru,
+					struct binder_lru_page, lru);
+		alloc = page->alloc;
+		if (!mutex_trylock(&alloc->mutex)) {
+			list_move_tail(&page->lru, &binder_alloc_lru);
+			continue;
+		}
+		list_del_init(&page->lru);
+		binder_alloc_lru_count--;
+		spin_unlock(&binder_alloc_lru_lock);
+
+		page_addr = alloc->buffer + (page - alloc->pages) * PAGE_SIZE;
+		mm = alloc->vma_vm_mm;
+		if (mm && !atomic_inc_not_zero(&mm->mm_users))
+			mm = NULL;
+		if (mm) {
+			if (!down_read_trylock(&mm->mmap_sem)) {
+				mmput(mm);
+				mutex_unlock(&alloc->mutex);
+				spin_lock(&binder_alloc_lru_lock);
+				list_add_tail(&page->lru, &binder_alloc_lru);
+				binder_alloc_lru_count++;
+				continue;
+			}
+			if (alloc->vma)
+				zap_page_range(alloc->vma, (uintptr_t)page_addr +
+					       alloc->user_buffer_offset,
+					       PAGE_SIZE, NULL);
+			up_read(&mm->mmap_sem);
+			mmput(mm);
+		}
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(page->page_ptr);
+		page->page_ptr = NULL;
+		mutex_unlock(&alloc->mutex);
+		freed++;
+
+		spin_lock(&binder_alloc_lru_lock);
+	}
+	count = binder_alloc_lru_count;
+	spin_unlock(&binder_alloc_lru_lock);
+
+	if (freed)
+		binder_alloc_debug(BINDER_DEBUG_SHRINKER,
+			     "binder: shrinker freed %d pages, %d cached\n",
+			     freed, count);
+	return count;
+}
+
+static struct shrinker binder_alloc_shrinker = {
+	.shrink = binder_alloc_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+void binder_alloc_init(struct binder_alloc *alloc, struct task_struct *tsk)
+{
+	mutex_init(&alloc->mutex);
+	alloc->tsk = tsk;
+	alloc->pid = tsk->group_leader->pid;
+	INIT_LIST_HEAD(&alloc->buffers);
+}
+
+int binder_alloc_shrinker_init(void)
+{
+	register_shrinker(&binder_alloc_shrinker);
+	return 0;
+}
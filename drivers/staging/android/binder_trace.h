@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2012 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM binder
+
+#if !defined(_BINDER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _BINDER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+struct binder_node;
+struct binder_proc;
+struct binder_transaction;
+
+TRACE_EVENT(binder_transaction,
+	TP_PROTO(bool reply, struct binder_transaction *t,
+		 struct binder_node *target_node),
+	TP_ARGS(reply, t, target_node),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, target_node)
+		__field(int, to_proc)
+		__field(int, to_thread)
+		__field(int, reply)
+		__field(unsigned int, code)
+		__field(unsigned int, flags)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->target_node = target_node ? target_node->debug_id : 0;
+		__entry->to_proc = t->to_proc->pid;
+		__entry->to_thread = t->to_thread ? t->to_thread->pid : 0;
+		__entry->reply = reply;
+		__entry->code = t->code;
+		__entry->flags = t->flags;
+	),
+	TP_printk("transaction=%d dest_node=%d dest_proc=%d dest_thread=%d reply=%d flags=0x%x code=0x%x",
+		  __entry->debug_id, __entry->target_node,
+		  __entry->to_proc, __entry->to_thread,
+		  __entry->reply, __entry->flags, __entry->code)
+);
+
+DECLARE_EVENT_CLASS(binder_latency_class,
+	TP_PROTO(struct binder_transaction *t, s64 latency_us),
+	TP_ARGS(t, latency_us),
+	TP_STRUCT__entry(
+		__field(int, debug_id)
+		__field(int, proc)
+		__field(unsigned int, code)
+		__field(s64, latency_us)
+	),
+	TP_fast_assign(
+		__entry->debug_id = t->debug_id;
+		__entry->proc = t->to_proc ? t->to_proc->pid : 0;
+		__entry->code = t->code;
+		__entry->latency_us = latency_us;
+	),
+	TP_printk("transaction=%d proc=%d code=0x%x latency=%lldus",
+		  __entry->debug_id, __entry->proc, __entry->code,
+		  __entry->latency_us)
+);
+
+DEFINE_EVENT(binder_latency_class, binder_transaction_received,
+	TP_PROTO(struct binder_transaction *t, s64 latency_us),
+	TP_ARGS(t, latency_us));
+
+DEFINE_EVENT(binder_latency_class, binder_transaction_replied,
+	TP_PROTO(struct binder_transaction *t, s64 latency_us),
+	TP_ARGS(t, latency_us));
+
+TRACE_EVENT(binder_thread_starved,
+	TP_PROTO(struct binder_proc *proc, int debug_id),
+	TP_ARGS(proc, debug_id),
+	TP_STRUCT__entry(
+		__field(int, proc)
+		__field(int, debug_id)
+		__field(int, starvations)
+	),
+	TP_fast_assign(
+		__entry->proc = proc->pid;
+		__entry->debug_id = debug_id;
+		__entry->starvations = proc->thread_starvations;
+	),
+	TP_printk("proc=%d transaction=%d starvations=%d",
+		  __entry->proc, __entry->debug_id, __entry->starvations)
+);
+
+#endif /* _BINDER_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_PATH .
+#define TRACE_INCLUDE_FILE binder_trace
+#include <trace/define_trace.h>
@@ -25,6 +25,8 @@
 #include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -33,6 +35,19 @@
 #define CONFIG_LOGCAT_SIZE 256
 #endif
 
+#define LOGGER_STAGE_SIZE	(8 * 1024)
+
+/*
+ * Per-cpu staging ring.  Writers append whole entries with preemption
+ * disabled and publish them by advancing head; the only consumer is
+ * logger_drain_stages(), which runs under log->mutex and advances tail.
+ */
+struct logger_stage {
+	unsigned char		*buf;
+	size_t			head;
+	size_t			tail;
+};
+
 struct logger_log {
 	unsigned char		*buffer;
 	struct miscdevice	misc;	
@@ -42,6 +57,7 @@ struct logger_log {
 	size_t			w_off;	
 	size_t			head;	
 	size_t			size;	
+	struct logger_stage __percpu *stage;
 };
 
 struct logger_reader {
@@ -49,6 +65,7 @@ struct logger_reader {
 	struct list_head	list;	
 	size_t			r_off;	
 	bool			r_all;	
+	bool			r_batch;
 	int			r_ver;	
 };
 
@@ -175,6 +192,37 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
 	return off;
 }
 
+static ssize_t do_read_batch_to_user(struct logger_log *log,
+				     struct logger_reader *reader,
+				     char __user *buf, size_t count,
+				     ssize_t done)
+{
+	ssize_t len;
+
+	while (1) {
+		if (!reader->r_all)
+			reader->r_off = get_next_entry_by_uid(log,
+				reader->r_off, current_euid());
+
+		if (log->w_off == reader->r_off)
+			break;
+
+		len = get_user_hdr_len(reader->r_ver) +
+			get_entry_msg_len(log, reader->r_off);
+		if (count - done < len)
+			break;
+
+		len = do_read_log_to_user(log, reader, buf + done, len);
+		if (len < 0)
+			break;
+		done += len;
+	}
+
+	return done;
+}
+
+static void logger_drain_stages(struct logger_log *log);
+
 /*
  * logger_read - our log's read() method
  *
@@ -182,7 +230,8 @@ static size_t get_next_entry_by_uid(struct logger_log *log,
  *
  *	- O_NONBLOCK works
  *	- If there are no log entries to read, blocks until log is written to
- *	- Atomically reads exactly one log entry
+ *	- Atomically reads exactly one log entry, or as many whole entries as
+ *	  fit in the buffer once LOGGER_SET_READ_BATCH is set
  *
  * Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -201,6 +250,7 @@ start:
 
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
+		logger_drain_stages(log);
 		ret = (log->w_off == reader->r_off);
 		mutex_unlock(&log->mutex);
 		if (!ret)
@@ -245,6 +295,8 @@ start:
 
 	
 	ret = do_read_log_to_user(log, reader, buf, ret);
+	if (reader->r_batch && ret > 0)
+		ret = do_read_batch_to_user(log, reader, buf, count, ret);
 
 out:
 	mutex_unlock(&log->mutex);
@@ -309,6 +361,134 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 
 }
 
+static void stage_write(struct logger_stage *stage, size_t off,
+			const void *buf, size_t count)
+{
+	size_t start = off & (LOGGER_STAGE_SIZE - 1);
+	size_t len = min(count, LOGGER_STAGE_SIZE - start);
+
+	memcpy(stage->buf + start, buf, len);
+	if (count != len)
+		memcpy(stage->buf, buf + len, count - len);
+}
+
+static int stage_write_from_user(struct logger_stage *stage, size_t off,
+				 const void __user *buf, size_t count)
+{
+	size_t start = off & (LOGGER_STAGE_SIZE - 1);
+	size_t len = min(count, LOGGER_STAGE_SIZE - start);
+
+	if (len && __copy_from_user_inatomic(stage->buf + start, buf, len))
+		return -EFAULT;
+	if (count != len &&
+	    __copy_from_user_inatomic(stage->buf, buf + len, count - len))
+		return -EFAULT;
+	return 0;
+}
+
+static void stage_read(struct logger_stage *stage, size_t off,
+		       void *buf, size_t count)
+{
+	size_t start = off & (LOGGER_STAGE_SIZE - 1);
+	size_t len = min(count, LOGGER_STAGE_SIZE - start);
+
+	memcpy(buf, stage->buf + start, len);
+	if (count != len)
+		memcpy(buf + len, stage->buf, count - len);
+}
+
+static bool logger_stage_write(struct logger_log *log,
+			       struct logger_entry *header,
+			       const struct iovec *iov, unsigned long nr_segs)
+{
+	struct logger_stage *stage;
+	struct timespec now;
+	size_t need = sizeof(struct logger_entry) + header->len;
+	size_t head, off;
+	size_t done = 0;
+	bool ret = false;
+
+	preempt_disable();
+	stage = this_cpu_ptr(log->stage);
+	head = stage->head;
+	if (LOGGER_STAGE_SIZE - (head - ACCESS_ONCE(stage->tail)) < need)
+		goto out;
+
+	smp_mb();
+
+	now = current_kernel_time();
+	header->sec = now.tv_sec;
+	header->nsec = now.tv_nsec;
+	stage_write(stage, head, header, sizeof(struct logger_entry));
+
+	off = head + sizeof(struct logger_entry);
+	pagefault_disable();
+	while (nr_segs-- > 0) {
+		size_t len = min_t(size_t, iov->iov_len, header->len - done);
+
+		if (stage_write_from_user(stage, off + done, iov->iov_base, len))
+			break;
+		done += len;
+		iov++;
+	}
+	pagefault_enable();
+	if (done != header->len)
+		goto out;
+
+	smp_wmb();
+	stage->head = head + need;
+	ret = true;
+out:
+	preempt_enable();
+	return ret;
+}
+
+/*
+ * Move staged entries into the shared ring, oldest timestamp first across
+ * all cpus.  Must be called with log->mutex held.
+ */
+static void logger_drain_stages(struct logger_log *log)
+{
+	struct logger_entry entry, best_entry;
+	struct logger_stage *stage, *best;
+	size_t start, len, need;
+	int cpu;
+
+	if (!log->stage)
+		return;
+
+	while (1) {
+		best = NULL;
+		for_each_possible_cpu(cpu) {
+			stage = per_cpu_ptr(log->stage, cpu);
+			if (stage->tail == ACCESS_ONCE(stage->head))
+				continue;
+			smp_rmb();
+			stage_read(stage, stage->tail, &entry, sizeof(entry));
+			if (best && (entry.sec > best_entry.sec ||
+				     (entry.sec == best_entry.sec &&
+				      entry.nsec >= best_entry.nsec)))
+				continue;
+			best = stage;
+			best_entry = entry;
+		}
+		if (!best)
+			break;
+
+		need = sizeof(struct logger_entry) + best_entry.len;
+		fix_up_readers(log, need);
+
+		start = best->tail & (LOGGER_STAGE_SIZE - 1);
+		len = min(need, LOGGER_STAGE_SIZE - start);
+		do_write_log(log, best->buf + start, len);
+		if (need != len)
+			do_write_log(log, best->buf, need - len);
+
+		smp_mb();
+		best->tail += need;
+	}
+}
+
 static ssize_t do_write_log_from_user(struct logger_log *log,
 				      const void __user *buf, size_t count)
 {
@@ -331,7 +511,7 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
+	size_t orig;
 	struct logger_entry header;
 	struct timespec now;
 	ssize_t ret = 0;
@@ -350,8 +530,19 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
+	if (log->stage && logger_stage_write(log, &header, iov, nr_segs)) {
+		wake_up_interruptible(&log->wq);
+		return header.len;
+	}
+
 	mutex_lock(&log->mutex);
 
+	logger_drain_stages(log);
+	now = current_kernel_time();
+	header.sec = now.tv_sec;
+	header.nsec = now.tv_nsec;
+	orig = log->w_off;
+
 	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
 
 	do_write_log(log, &header, sizeof(struct logger_entry));
@@ -407,6 +598,7 @@ static int logger_open(struct inode *inode, struct file *file)
 
 		reader->log = log;
 		reader->r_ver = 1;
+		reader->r_batch = false;
 		reader->r_all = in_egroup_p(inode->i_gid) ||
 			capable(CAP_SYSLOG);
 
@@ -455,6 +647,7 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &log->wq, wait);
 
 	mutex_lock(&log->mutex);
+	logger_drain_stages(log);
 	if (!reader->r_all)
 		reader->r_off = get_next_entry_by_uid(log,
 			reader->r_off, current_euid());
@@ -479,6 +672,17 @@ static long logger_set_version(struct logger_reader *reader, void __user *arg)
 	return 0;
 }
 
+static long logger_set_read_batch(struct logger_reader *reader,
+				  void __user *arg)
+{
+	int batch;
+	if (copy_from_user(&batch, arg, sizeof(int)))
+		return -EFAULT;
+
+	reader->r_batch = !!batch;
+	return 0;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
@@ -488,6 +692,8 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 
 	mutex_lock(&log->mutex);
 
+	logger_drain_stages(log);
+
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
 		ret = log->size;
@@ -546,6 +752,14 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		reader = file->private_data;
 		ret = logger_set_version(reader, argp);
 		break;
+	case LOGGER_SET_READ_BATCH:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		ret = logger_set_read_batch(reader, argp);
+		break;
 	}
 
 	mutex_unlock(&log->mutex);
@@ -604,10 +818,39 @@ static struct logger_log *get_log_from_minor(int minor)
 	return NULL;
 }
 
+static void __init init_log_stages(struct logger_log *log)
+{
+	struct logger_stage *stage;
+	int cpu;
+
+	log->stage = alloc_percpu(struct logger_stage);
+	if (!log->stage)
+		goto err;
+
+	for_each_possible_cpu(cpu) {
+		stage = per_cpu_ptr(log->stage, cpu);
+		stage->buf = kmalloc(LOGGER_STAGE_SIZE, GFP_KERNEL);
+		if (!stage->buf)
+			goto err_free;
+	}
+	return;
+
+err_free:
+	for_each_possible_cpu(cpu)
+		kfree(per_cpu_ptr(log->stage, cpu)->buf);
+	free_percpu(log->stage);
+	log->stage = NULL;
+err:
+	printk(KERN_WARNING "logger: no staging buffers for log '%s'\n",
+	       log->misc.name);
+}
+
 static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	init_log_stages(log);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -17,6 +17,18 @@
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
  *
+ * Writing 1 to /sys/module/lowmemorykiller/parameters/pressure_enable also
+ * takes reclaim efficiency into account.  While the vmpressure reported by
+ * reclaim is at least pressure_kill, processes in the last adj level are
+ * killed even if no minfree threshold is crossed.  While it is below
+ * pressure_defer, kills for every level but the first are deferred since
+ * reclaim is still making progress.
+ *
+ * Processes are kept on per-adj candidate lists, updated at fork, exec and
+ * whenever oom_score_adj is written, so that a kill does not have to walk
+ * every task.  The full task list is only walked when no candidate can be
+ * selected.
+ *
  * Copyright (C) 2007-2008 Google, Inc.
  *
  * This software is licensed under the terms of the GNU General Public
@@ -41,6 +53,11 @@
 #include <linux/delay.h>
 #include <linux/swap.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/vmpressure.h>
 
 #ifdef CONFIG_HIGHMEM
 	#define _ZONE ZONE_HIGHMEM
@@ -66,10 +83,37 @@ static int lowmem_minfree[6] = {
 };
 static int lowmem_minfree_size = 4;
 
+static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 static uint32_t lowmem_sleep_ms = 1;
 static uint32_t lowmem_only_kswapd_sleep = 1;
 
+static uint32_t lowmem_pressure_enable;
+static uint32_t lowmem_pressure_kill = 95;
+static uint32_t lowmem_pressure_defer = 60;
+static atomic_t lowmem_pressure = ATOMIC_INIT(-1);
+static unsigned long lowmem_pressure_stamp;
+
+struct lowmem_adj_list {
+	struct rb_node node;
+	struct list_head tasks;
+	int adj;
+};
+
+struct lowmem_candidate {
+	struct list_head list;
+	struct hlist_node hash;
+	struct lowmem_adj_list *adj_list;
+	struct task_struct *tsk;
+};
+
+#define LOWMEM_HASH_BITS	8
+#define LOWMEM_SCAN_BATCH	64
+
+static struct hlist_head lowmem_candidate_hash[1 << LOWMEM_HASH_BITS];
+static struct rb_root lowmem_adj_root = RB_ROOT;
+static DEFINE_SPINLOCK(lowmem_candidate_lock);
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -114,6 +158,333 @@ static int test_task_flag(struct task_struct *p, int flag)
 
 static DEFINE_MUTEX(scan_mutex);
 
+/* protected by scan_mutex */
+static struct task_struct *lowmem_scan_tasks[LOWMEM_SCAN_BATCH];
+
+static struct lowmem_candidate *lowmem_candidate_find(struct task_struct *tsk)
+{
+	struct hlist_head *head;
+	struct hlist_node *node;
+	struct lowmem_candidate *c;
+
+	head = &lowmem_candidate_hash[hash_ptr(tsk, LOWMEM_HASH_BITS)];
+	hlist_for_each_entry(c, node, head, hash) {
+		if (c->tsk == tsk)
+			return c;
+	}
+	return NULL;
+}
+
+static struct lowmem_adj_list *lowmem_adj_list_get(int adj)
+{
+	struct rb_node **p = &lowmem_adj_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct lowmem_adj_list *al;
+
+	while (*p) {
+		parent = *p;
+		al = rb_entry(parent, struct lowmem_adj_list, node);
+
+		if (adj < al->adj)
+			p = &parent->rb_left;
+		else if (adj > al->adj)
+			p = &parent->rb_right;
+		else
+			return al;
+	}
+
+	al = kmalloc(sizeof(*al), GFP_ATOMIC);
+	if (!al)
+		return NULL;
+	INIT_LIST_HEAD(&al->tasks);
+	al->adj = adj;
+	rb_link_node(&al->node, parent, p);
+	rb_insert_color(&al->node, &lowmem_adj_root);
+	return al;
+}
+
+static struct lowmem_adj_list *lowmem_adj_list_below(int adj)
+{
+	struct rb_node *n = lowmem_adj_root.rb_node;
+	struct lowmem_adj_list *al, *found = NULL;
+
+	while (n) {
+		al = rb_entry(n, struct lowmem_adj_list, node);
+		if (al->adj < adj) {
+			found = al;
+			n = n->rb_right;
+		} else {
+			n = n->rb_left;
+		}
+	}
+	return found;
+}
+
+static void lowmem_candidate_unlink(struct lowmem_candidate *c)
+{
+	struct lowmem_adj_list *al = c->adj_list;
+
+	list_del(&c->list);
+	c->adj_list = NULL;
+	if (list_empty(&al->tasks)) {
+		rb_erase(&al->node, &lowmem_adj_root);
+		kfree(al);
+	}
+}
+
+static void lowmem_candidate_free(struct lowmem_candidate *c)
+{
+	lowmem_candidate_unlink(c);
+	hlist_del(&c->hash);
+	kfree(c);
+}
+
+static void lowmem_candidate_update(struct task_struct *tsk, int adj)
+{
+	struct lowmem_candidate *c;
+	struct lowmem_adj_list *al;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_candidate_lock, flags);
+	c = lowmem_candidate_find(tsk);
+	if (c && c->adj_list->adj == adj)
+		goto out;
+
+	if (!c) {
+		c = kmalloc(sizeof(*c), GFP_ATOMIC);
+		if (!c)
+			goto out;
+		c->tsk = tsk;
+		c->adj_list = NULL;
+		hlist_add_head(&c->hash, &lowmem_candidate_hash[
+			       hash_ptr(tsk, LOWMEM_HASH_BITS)]);
+	} else {
+		lowmem_candidate_unlink(c);
+	}
+
+	al = lowmem_adj_list_get(adj);
+	if (!al) {
+		hlist_del(&c->hash);
+		kfree(c);
+		goto out;
+	}
+	c->adj_list = al;
+	list_add_tail(&c->list, &al->tasks);
+out:
+	spin_unlock_irqrestore(&lowmem_candidate_lock, flags);
+}
+
+static int lowmem_oom_score_adj_notify(struct notifier_block *nb,
+				       unsigned long val, void *data)
+{
+	struct task_struct *tsk = data;
+
+	rcu_read_lock();
+	if (pid_alive(tsk))
+		lowmem_candidate_update(tsk->group_leader, (int)val);
+	rcu_read_unlock();
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_oom_score_adj_nb = {
+	.notifier_call = lowmem_oom_score_adj_notify,
+};
+
+static int lowmem_task_free_notify(struct notifier_block *nb,
+				   unsigned long val, void *data)
+{
+	struct lowmem_candidate *c;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_candidate_lock, flags);
+	if (data == lowmem_deathpending)
+		lowmem_deathpending = NULL;
+	c = lowmem_candidate_find(data);
+	if (c)
+		lowmem_candidate_free(c);
+	spin_unlock_irqrestore(&lowmem_candidate_lock, flags);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_task_free_nb = {
+	.notifier_call = lowmem_task_free_notify,
+};
+
+static int lowmem_vmpressure_notify(struct notifier_block *nb,
+				    unsigned long pressure, void *data)
+{
+	atomic_set(&lowmem_pressure, pressure);
+	lowmem_pressure_stamp = jiffies;
+	return NOTIFY_OK;
+}
+
+static struct notifier_block lowmem_vmpressure_nb = {
+	.notifier_call = lowmem_vmpressure_notify,
+};
+
+static int lowmem_pressure_adjust(int min_score_adj, int level, int array_size)
+{
+	int pressure = atomic_read(&lowmem_pressure);
+
+	if (pressure < 0 || time_after(jiffies, lowmem_pressure_stamp + HZ))
+		return min_score_adj;
+
+	if (pressure >= lowmem_pressure_kill && level == array_size &&
+	    array_size > 0) {
+		lowmem_print(3, "lowmem_shrink pressure %d, kill adj %d\n",
+			     pressure, lowmem_adj[array_size - 1]);
+		return lowmem_adj[array_size - 1];
+	}
+
+	if (pressure < lowmem_pressure_defer && level > 0 &&
+	    level < array_size) {
+		lowmem_print(3, "lowmem_shrink pressure %d, defer adj %d\n",
+			     pressure, min_score_adj);
+		return OOM_SCORE_ADJ_MAX + 1;
+	}
+
+	return min_score_adj;
+}
+
+static int lowmem_check_task(struct task_struct *tsk, int min_score_adj,
+			     struct task_struct **selected,
+			     int *selected_tasksize,
+			     int *selected_oom_score_adj)
+{
+	struct task_struct *p;
+	int oom_score_adj;
+	int tasksize;
+
+	if (tsk->flags & PF_KTHREAD)
+		return 0;
+
+	if (test_task_flag(tsk, TIF_MM_RELEASED))
+		return 0;
+
+	if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		if (test_task_flag(tsk, TIF_MEMDIE)) {
+			lowmem_print(2, "skipping , waiting for process %d (%s) dead\n",
+			tsk->pid, tsk->comm);
+			return 1;
+		}
+	}
+
+	p = find_lock_task_mm(tsk);
+	if (!p)
+		return 0;
+
+	oom_score_adj = p->signal->oom_score_adj;
+	if (oom_score_adj < min_score_adj) {
+		task_unlock(p);
+		return 0;
+	}
+	tasksize = get_mm_rss(p->mm);
+	task_unlock(p);
+	if (tasksize <= 0)
+		return 0;
+	if (*selected) {
+		if (oom_score_adj < *selected_oom_score_adj)
+			return 0;
+		if (oom_score_adj == *selected_oom_score_adj &&
+		    tasksize <= *selected_tasksize)
+			return 0;
+	}
+	*selected = p;
+	*selected_tasksize = tasksize;
+	*selected_oom_score_adj = oom_score_adj;
+	lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
+		     p->pid, p->comm, p->signal->oom_adj, oom_score_adj, tasksize);
+	return 0;
+}
+
+/*
+ * Pin the next batch of tasks on the adj list at @adj.  The batch starts
+ * after @cursor if it is still on that list, else after the first @skip
+ * entries.  Called with lowmem_candidate_lock held.
+ */
+static int lowmem_fill_batch(int adj, struct task_struct *cursor, int skip)
+{
+	struct lowmem_adj_list *al;
+	struct lowmem_candidate *c;
+	int nr = 0;
+
+	al = lowmem_adj_list_below(adj + 1);
+	if (!al || al->adj != adj)
+		return 0;
+
+	c = cursor ? lowmem_candidate_find(cursor) : NULL;
+	if (!c || c->adj_list != al) {
+		c = list_entry(&al->tasks, struct lowmem_candidate, list);
+		for (; skip > 0 && c->list.next != &al->tasks; skip--)
+			c = list_entry(c->list.next, struct lowmem_candidate,
+				       list);
+	}
+
+	list_for_each_entry_continue(c, &al->tasks, list) {
+		if (nr == LOWMEM_SCAN_BATCH)
+			break;
+		if (atomic_inc_not_zero(&c->tsk->usage))
+			lowmem_scan_tasks[nr++] = c->tsk;
+	}
+	return nr;
+}
+
+/*
+ * lowmem_candidate_lock is taken from the task free notifier, which can run
+ * in softirq context, so the tasks of each adj list are pinned and copied
+ * out under the lock in batches and only checked, which takes task_lock,
+ * after it has been dropped.  The last task of a full batch stays pinned
+ * as the cursor the next batch resumes from.
+ */
+static int lowmem_scan_candidates(int min_score_adj,
+				  struct task_struct **selected,
+				  int *selected_tasksize,
+				  int *selected_oom_score_adj)
+{
+	struct lowmem_adj_list *al;
+	struct task_struct *tsk, *cursor = NULL;
+	unsigned long flags;
+	int adj = OOM_SCORE_ADJ_MAX + 1;
+	int nr, i, done = 0;
+	int ret = 0;
+
+	do {
+		spin_lock_irqsave(&lowmem_candidate_lock, flags);
+		if (!cursor) {
+			al = lowmem_adj_list_below(adj);
+			if (!al || al->adj < min_score_adj) {
+				spin_unlock_irqrestore(&lowmem_candidate_lock,
+						       flags);
+				break;
+			}
+			adj = al->adj;
+			done = 0;
+		}
+		nr = lowmem_fill_batch(adj, cursor, done);
+		spin_unlock_irqrestore(&lowmem_candidate_lock, flags);
+
+		if (cursor)
+			put_task_struct(cursor);
+		cursor = NULL;
+
+		for (i = 0; i < nr; i++) {
+			tsk = lowmem_scan_tasks[i];
+			if (!ret && pid_alive(tsk))
+				ret = lowmem_check_task(tsk, min_score_adj,
+							selected,
+							selected_tasksize,
+							selected_oom_score_adj);
+			if (!ret && nr == LOWMEM_SCAN_BATCH && i == nr - 1)
+				cursor = tsk;
+			else
+				put_task_struct(tsk);
+		}
+		done += nr;
+	} while (!ret && (cursor || !*selected));
+
+	return ret;
+}
+
 int can_use_cma_pages(gfp_t gfp_mask)
 {
 	int can_use = 0;
@@ -144,12 +515,12 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	struct task_struct *tsk;
 	struct task_struct *selected = NULL;
 	int rem = 0;
-	int tasksize;
 	int i;
 	int min_score_adj = OOM_SCORE_ADJ_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_score_adj;
 	int selected_oom_adj = 0;
+	int pending;
 	int array_size = ARRAY_SIZE(lowmem_adj);
 	int other_free;
 	int other_file;
@@ -199,6 +570,9 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			break;
 		}
 	}
+	if (lowmem_pressure_enable)
+		min_score_adj = lowmem_pressure_adjust(min_score_adj, i,
+						       array_size);
 	if (nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %lu, %x, ofree %d %d, ma %d, rfree %d\n",
 				nr_to_scan, sc->gfp_mask, other_free,
@@ -218,62 +592,40 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	}
 	selected_oom_score_adj = min_score_adj;
 
-	rcu_read_lock();
-	for_each_process(tsk) {
-		struct task_struct *p;
-		int oom_score_adj;
-
-		if (tsk->flags & PF_KTHREAD)
-			continue;
+	pending = lowmem_deathpending &&
+		  time_before_eq(jiffies, lowmem_deathpending_timeout);
+	if (pending)
+		lowmem_print(2, "skipping, waiting for last victim to die\n");
 
-		
-		if (test_task_flag(tsk, TIF_MM_RELEASED))
-			continue;
-
-		if (time_before_eq(jiffies, lowmem_deathpending_timeout)) {
-			if (test_task_flag(tsk, TIF_MEMDIE)) {
-				lowmem_print(2, "skipping , waiting for process %d (%s) dead\n",
-				tsk->pid, tsk->comm);
-				rcu_read_unlock();
-				
-				if (!(lowmem_only_kswapd_sleep && !current_is_kswapd())) {
-					msleep_interruptible(lowmem_sleep_ms);
-				}
-				mutex_unlock(&scan_mutex);
-				return 0;
-			}
-		}
-
-		p = find_lock_task_mm(tsk);
-		if (!p)
-			continue;
-
-		oom_score_adj = p->signal->oom_score_adj;
-		if (oom_score_adj < min_score_adj) {
-			task_unlock(p);
-			continue;
+	rcu_read_lock();
+	if (!pending)
+		pending = lowmem_scan_candidates(min_score_adj, &selected,
+						 &selected_tasksize,
+						 &selected_oom_score_adj);
+	if (!pending && !selected) {
+		for_each_process(tsk) {
+			pending = lowmem_check_task(tsk, min_score_adj,
+						    &selected,
+						    &selected_tasksize,
+						    &selected_oom_score_adj);
+			if (pending)
+				break;
 		}
-		tasksize = get_mm_rss(p->mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_score_adj < selected_oom_score_adj)
-				continue;
-			if (oom_score_adj == selected_oom_score_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
+	}
+	if (pending) {
+		rcu_read_unlock();
+		
+		if (!(lowmem_only_kswapd_sleep && !current_is_kswapd())) {
+			msleep_interruptible(lowmem_sleep_ms);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_score_adj = oom_score_adj;
-		selected_oom_adj = p->signal->oom_adj;
-		lowmem_print(2, "select %d (%s), oom_adj %d score_adj %d, size %d, to kill\n",
-			     p->pid, p->comm, selected_oom_adj, oom_score_adj, tasksize);
+		mutex_unlock(&scan_mutex);
+		return 0;
 	}
 	if (selected) {
 		bool should_dump_meminfo = false;
 
+		selected_oom_adj = selected->signal->oom_adj;
+
 		lowmem_print(1, "[%s] send sigkill to %d (%s), oom_adj %d, score_adj %d,"
 			" min_score_adj %d, size %dK, free %dK, file %dK, "
 			" reserved_free %dK, cma_free %dK, use_cma %d\n",
@@ -282,6 +634,7 @@ static int lowmem_shrink(struct shrinker *s, struct shrink_control *sc)
 			     min_score_adj, selected_tasksize << 2,
 			     other_free << 2, other_file << 2, reserved_free << 2, cma_free << 2, use_cma);
 
+		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 #ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_AUTODETECT_OOM_ADJ_VALUES
 #define DUMP_INFO_OOM_SCORE_ADJ_THRESHOLD	((7 * OOM_SCORE_ADJ_MAX) / -OOM_DISABLE)
@@ -319,13 +672,31 @@ static struct shrinker lowmem_shrinker = {
 
 static int __init lowmem_init(void)
 {
+	task_free_register(&lowmem_task_free_nb);
+	register_oom_score_adj_notifier(&lowmem_oom_score_adj_nb);
+	vmpressure_notifier_register(&lowmem_vmpressure_nb);
 	register_shrinker(&lowmem_shrinker);
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	struct hlist_node *node, *next;
+	struct lowmem_candidate *c;
+	unsigned long flags;
+	int i;
+
 	unregister_shrinker(&lowmem_shrinker);
+	vmpressure_notifier_unregister(&lowmem_vmpressure_nb);
+	unregister_oom_score_adj_notifier(&lowmem_oom_score_adj_nb);
+	task_free_unregister(&lowmem_task_free_nb);
+
+	spin_lock_irqsave(&lowmem_candidate_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(lowmem_candidate_hash); i++)
+		hlist_for_each_entry_safe(c, node, next,
+					  &lowmem_candidate_hash[i], hash)
+			lowmem_candidate_free(c);
+	spin_unlock_irqrestore(&lowmem_candidate_lock, flags);
 }
 
 #ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER_AUTODETECT_OOM_ADJ_VALUES
@@ -419,6 +790,12 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(pressure_enable, lowmem_pressure_enable, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_kill, lowmem_pressure_kill, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(pressure_defer, lowmem_pressure_defer, uint,
+		   S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
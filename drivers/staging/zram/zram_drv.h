@@ -19,6 +19,7 @@
 #include <linux/mutex.h>
 
 #include "../zsmalloc/zsmalloc.h"
+#include "zcomp.h"
 
 static const unsigned max_num_devices = 32;
 
@@ -36,9 +37,17 @@ static const size_t max_zpage_size = PAGE_SIZE / 10 * 9;
 #define ZRAM_SECTOR_PER_LOGICAL_BLOCK	\
 	(1 << (ZRAM_LOGICAL_BLOCK_SHIFT - SECTOR_SHIFT))
 
+/*
+ * The lower ZRAM_FLAG_SHIFT bits of table.value hold the compressed object
+ * size, the upper bits are zram_pageflags.  ZRAM_ACCESS is a bit spinlock
+ * serialising access to the slot.
+ */
+#define ZRAM_FLAG_SHIFT 24
+
 enum zram_pageflags {
 	
-	ZRAM_ZERO,
+	ZRAM_ZERO = ZRAM_FLAG_SHIFT + 1,
+	ZRAM_ACCESS,
 
 	__NR_ZRAM_PAGEFLAGS,
 };
@@ -46,10 +55,8 @@ enum zram_pageflags {
 
 struct table {
 	unsigned long handle;
-	u16 size;	
-	u8 count;	
-	u8 flags;
-} __aligned(4);
+	unsigned long value;
+};
 
 struct zram_stats {
 	atomic64_t compr_size;	
@@ -59,30 +66,20 @@ struct zram_stats {
 	atomic64_t failed_writes;	
 	atomic64_t invalid_io;	
 	atomic64_t notify_free;	
-	u32 pages_zero;		
-	u32 pages_stored;	
-	u32 good_compress;	
-	u32 bad_compress;	
+	atomic64_t pages_zero;		
+	atomic64_t pages_stored;	
+	atomic64_t good_compress;	
+	atomic64_t bad_compress;	
 };
 
 struct zram_meta {
-	void *compress_workmem;
-	void *compress_buffer;
 	struct table *table;
 	struct zs_pool *mem_pool;
 };
 
-struct zram_slot_free {
-	unsigned long index;
-	struct zram_slot_free *next;
-};
-
 struct zram {
 	struct zram_meta *meta;
-	struct rw_semaphore lock; 
-
-	struct work_struct free_work;  
-	struct zram_slot_free *slot_free_rq; 
+	struct zcomp *comp;
 
 	struct request_queue *queue;
 	struct gendisk *disk;
@@ -90,7 +87,8 @@ struct zram {
 	
 	struct rw_semaphore init_lock;
 	u64 disksize;	
-	spinlock_t slot_free_lock;
+	int max_comp_streams;
+	char compressor[10];
 
 	struct zram_stats stats;
 };
@@ -32,6 +32,11 @@
 #include <linux/hardirq.h>
 #include <linux/spinlock.h>
 #include <linux/types.h>
+#include <linux/bit_spinlock.h>
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "zsmalloc.h"
 
@@ -49,7 +54,17 @@
 #endif
 #endif
 #define _PFN_BITS		(MAX_PHYSMEM_BITS - PAGE_SHIFT)
-#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS)
+
+/*
+ * A handle is a pointer to a word, allocated from zs_handle_cache, that
+ * holds the current location of the object shifted by OBJ_TAG_BITS.  The
+ * low bit is a pin lock: it is held while the object is mapped or being
+ * freed, and compaction only moves objects whose pin it can take.
+ */
+#define OBJ_TAG_BITS	1
+#define HANDLE_PIN_BIT	0
+
+#define OBJ_INDEX_BITS	(BITS_PER_LONG - _PFN_BITS - OBJ_TAG_BITS)
 #define OBJ_INDEX_MASK	((_AC(1, UL) << OBJ_INDEX_BITS) - 1)
 
 #define MAX(a, b) ((a) >= (b) ? (a) : (b))
@@ -81,10 +96,26 @@ struct size_class {
 
 	spinlock_t lock;
 
+	int objs_per_zspage;
+
 	
 	u64 pages_allocated;
+	unsigned long obj_allocated;
+	unsigned long obj_used;
+	unsigned long pages_compacted;
 
 	struct page *fullness_list[_ZS_NR_FULLNESS_GROUPS];
+	unsigned long zspage_count[_ZS_NR_FULLNESS_GROUPS];
+};
+
+/*
+ * Hung off first_page->private.  handles[] maps each object slot of the
+ * zspage to the handle that owns it, so that compaction can find the live
+ * objects of a zspage and the handles it has to update.
+ */
+struct zspage_meta {
+	struct page *head_extra;
+	unsigned long handles[];
 };
 
 struct link_free {
@@ -96,6 +127,13 @@ struct zs_pool {
 	struct size_class size_class[ZS_SIZE_CLASSES];
 
 	gfp_t flags;	
+
+	struct shrinker shrinker;
+	atomic_long_t pages_compacted;
+
+#ifdef CONFIG_ZSMALLOC_STAT
+	struct dentry *stat_dentry;
+#endif
 };
 
 #define CLASS_IDX_BITS	28
@@ -120,6 +158,8 @@ struct mapping_area {
 
 static DEFINE_PER_CPU(struct mapping_area, zs_map_area);
 
+static struct kmem_cache *zs_handle_cache;
+
 static int is_first_page(struct page *page)
 {
 	return PagePrivate(page);
@@ -199,6 +239,7 @@ static void insert_zspage(struct page *page, struct size_class *class,
 		list_add_tail(&page->lru, &(*head)->lru);
 
 	*head = page;
+	class->zspage_count[fullness]++;
 }
 
 static void remove_zspage(struct page *page, struct size_class *class,
@@ -220,6 +261,7 @@ static void remove_zspage(struct page *page, struct size_class *class,
 					struct page, lru);
 
 	list_del_init(&page->lru);
+	class->zspage_count[fullness]--;
 }
 
 static enum fullness_group fix_fullness_group(struct zs_pool *pool,
@@ -268,6 +310,11 @@ static int get_pages_per_zspage(int class_size)
 	return max_usedpc_order;
 }
 
+static struct zspage_meta *zspage_meta(struct page *first_page)
+{
+	return (struct zspage_meta *)page_private(first_page);
+}
+
 static struct page *get_first_page(struct page *page)
 {
 	if (is_first_page(page))
@@ -283,33 +330,58 @@ static struct page *get_next_page(struct page *page)
 	if (is_last_page(page))
 		next = NULL;
 	else if (is_first_page(page))
-		next = (struct page *)page_private(page);
+		next = zspage_meta(page)->head_extra;
 	else
 		next = list_entry(page->lru.next, struct page, lru);
 
 	return next;
 }
 
-static void *obj_location_to_handle(struct page *page, unsigned long obj_idx)
+static void *location_to_obj(struct page *page, unsigned long obj_idx)
 {
-	unsigned long handle;
+	unsigned long obj;
 
 	if (!page) {
 		BUG_ON(obj_idx);
 		return NULL;
 	}
 
-	handle = page_to_pfn(page) << OBJ_INDEX_BITS;
-	handle |= ((obj_idx + 1) & OBJ_INDEX_MASK);
+	obj = page_to_pfn(page) << OBJ_INDEX_BITS;
+	obj |= ((obj_idx + 1) & OBJ_INDEX_MASK);
 
-	return (void *)handle;
+	return (void *)obj;
 }
 
-static void obj_handle_to_location(unsigned long handle, struct page **page,
+static void obj_to_location(unsigned long obj, struct page **page,
 				unsigned long *obj_idx)
 {
-	*page = pfn_to_page(handle >> OBJ_INDEX_BITS);
-	*obj_idx = (handle & OBJ_INDEX_MASK) - 1;
+	*page = pfn_to_page(obj >> OBJ_INDEX_BITS);
+	*obj_idx = (obj & OBJ_INDEX_MASK) - 1;
+}
+
+static unsigned long handle_to_obj(unsigned long handle)
+{
+	return *(unsigned long *)handle >> OBJ_TAG_BITS;
+}
+
+static void record_obj(unsigned long handle, unsigned long obj)
+{
+	*(unsigned long *)handle = obj << OBJ_TAG_BITS;
+}
+
+static void pin_tag(unsigned long handle)
+{
+	bit_spin_lock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static int trypin_tag(unsigned long handle)
+{
+	return bit_spin_trylock(HANDLE_PIN_BIT, (unsigned long *)handle);
+}
+
+static void unpin_tag(unsigned long handle)
+{
+	bit_spin_unlock(HANDLE_PIN_BIT, (unsigned long *)handle);
 }
 
 static unsigned long obj_idx_to_offset(struct page *page,
@@ -323,6 +395,41 @@ static unsigned long obj_idx_to_offset(struct page *page,
 	return off + obj_idx * class_size;
 }
 
+static unsigned long *zspage_handles(struct page *first_page)
+{
+	return zspage_meta(first_page)->handles;
+}
+
+static unsigned int obj_to_slot(struct page *page, unsigned long obj_idx,
+				int class_size)
+{
+	struct page *p = get_first_page(page);
+	unsigned long off = obj_idx_to_offset(page, obj_idx, class_size);
+
+	while (p != page) {
+		off += PAGE_SIZE;
+		p = get_next_page(p);
+	}
+
+	return off / class_size;
+}
+
+static unsigned long slot_to_obj(struct page *first_page, unsigned int slot,
+				int class_size)
+{
+	unsigned long off = (unsigned long)slot * class_size;
+	struct page *page = first_page;
+
+	while (off >= PAGE_SIZE) {
+		off -= PAGE_SIZE;
+		page = get_next_page(page);
+	}
+	if (page != first_page)
+		off -= page->index;
+
+	return (unsigned long)location_to_obj(page, off / class_size);
+}
+
 static void reset_page(struct page *page)
 {
 	clear_bit(PG_private, &page->flags);
@@ -336,11 +443,14 @@ static void reset_page(struct page *page)
 static void free_zspage(struct page *first_page)
 {
 	struct page *nextp, *tmp, *head_extra;
+	struct zspage_meta *meta;
 
 	BUG_ON(!is_first_page(first_page));
 	BUG_ON(first_page->inuse);
 
-	head_extra = (struct page *)page_private(first_page);
+	meta = zspage_meta(first_page);
+	head_extra = meta->head_extra;
+	kfree(meta);
 
 	reset_page(first_page);
 	__free_page(first_page);
@@ -379,13 +489,13 @@ static void init_zspage(struct page *first_page, struct size_class *class)
 		for (i = 1; i <= objs_on_page; i++) {
 			off += class->size;
 			if (off < PAGE_SIZE) {
-				link->next = obj_location_to_handle(page, i);
+				link->next = location_to_obj(page, i);
 				link += class->size / sizeof(*link);
 			}
 		}
 
 		next_page = get_next_page(page);
-		link->next = obj_location_to_handle(next_page, 0);
+		link->next = location_to_obj(next_page, 0);
 		kunmap_atomic(link);
 		page = next_page;
 		off = (off + class->size) % PAGE_SIZE;
@@ -396,6 +506,12 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 {
 	int i, error;
 	struct page *first_page = NULL, *uninitialized_var(prev_page);
+	struct zspage_meta *meta;
+
+	meta = kzalloc(sizeof(*meta) + class->objs_per_zspage *
+			sizeof(unsigned long), flags & ~__GFP_HIGHMEM);
+	if (!meta)
+		return NULL;
 
 	error = -ENOMEM;
 	for (i = 0; i < class->pages_per_zspage; i++) {
@@ -408,12 +524,12 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 		INIT_LIST_HEAD(&page->lru);
 		if (i == 0) {	
 			SetPagePrivate(page);
-			set_page_private(page, 0);
+			set_page_private(page, (unsigned long)meta);
 			first_page = page;
 			first_page->inuse = 0;
 		}
 		if (i == 1)
-			set_page_private(first_page, (unsigned long)page);
+			meta->head_extra = page;
 		if (i >= 1)
 			page->first_page = first_page;
 		if (i >= 2)
@@ -425,15 +541,18 @@ static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
 
 	init_zspage(first_page, class);
 
-	first_page->freelist = obj_location_to_handle(first_page, 0);
+	first_page->freelist = location_to_obj(first_page, 0);
 	
-	first_page->objects = class->pages_per_zspage * PAGE_SIZE / class->size;
+	first_page->objects = class->objs_per_zspage;
 
 	error = 0; 
 
 cleanup:
-	if (unlikely(error) && first_page) {
-		free_zspage(first_page);
+	if (unlikely(error)) {
+		if (first_page)
+			free_zspage(first_page);
+		else
+			kfree(meta);
 		first_page = NULL;
 	}
 
@@ -454,6 +573,54 @@ static struct page *find_get_zspage(struct size_class *class)
 	return page;
 }
 
+static unsigned long obj_malloc(struct size_class *class,
+				struct page *first_page, unsigned long handle)
+{
+	unsigned long obj;
+	struct link_free *link;
+	struct page *m_page;
+	unsigned long m_objidx, m_offset;
+
+	obj = (unsigned long)first_page->freelist;
+	obj_to_location(obj, &m_page, &m_objidx);
+	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
+
+	link = (struct link_free *)kmap_atomic(m_page) +
+					m_offset / sizeof(*link);
+	first_page->freelist = link->next;
+	memset(link, POISON_INUSE, sizeof(*link));
+	kunmap_atomic(link);
+
+	zspage_handles(first_page)[obj_to_slot(m_page, m_objidx,
+						class->size)] = handle;
+	first_page->inuse++;
+	class->obj_used++;
+
+	return obj;
+}
+
+static void obj_free(struct size_class *class, unsigned long obj)
+{
+	struct link_free *link;
+	struct page *first_page, *f_page;
+	unsigned long f_objidx, f_offset;
+
+	obj_to_location(obj, &f_page, &f_objidx);
+	first_page = get_first_page(f_page);
+	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
+
+	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
+							+ f_offset);
+	link->next = first_page->freelist;
+	kunmap_atomic(link);
+	first_page->freelist = (void *)obj;
+
+	zspage_handles(first_page)[obj_to_slot(f_page, f_objidx,
+						class->size)] = 0;
+	first_page->inuse--;
+	class->obj_used--;
+}
+
 #ifdef USE_PGTABLE_MAPPING
 static inline int __zs_cpu_up(struct mapping_area *area)
 {
@@ -591,6 +758,131 @@ static struct notifier_block zs_cpu_nb = {
 	.notifier_call = zs_cpu_notifier
 };
 
+#ifdef CONFIG_ZSMALLOC_STAT
+
+static struct dentry *zs_stat_root;
+static atomic_t zs_pool_id = ATOMIC_INIT(0);
+
+static int zs_stat_init(void)
+{
+	if (!debugfs_initialized())
+		return -ENODEV;
+
+	zs_stat_root = debugfs_create_dir("zsmalloc", NULL);
+	if (!zs_stat_root)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void zs_stat_exit(void)
+{
+	debugfs_remove_recursive(zs_stat_root);
+}
+
+static int zs_stats_size_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct zs_pool *pool = s->private;
+	unsigned long almost_full, almost_empty, obj_allocated, obj_used;
+	unsigned long pages_used, compacted;
+	unsigned long total_objs = 0, total_used_objs = 0, total_pages = 0;
+	unsigned long total_compacted = 0;
+
+	seq_printf(s, " %5s %5s %11s %12s %13s %10s %10s %16s %9s\n",
+			"class", "size", "almost_full", "almost_empty",
+			"obj_allocated", "obj_used", "pages_used",
+			"pages_per_zspage", "compacted");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock(&class->lock);
+		almost_full = class->zspage_count[ZS_ALMOST_FULL];
+		almost_empty = class->zspage_count[ZS_ALMOST_EMPTY];
+		obj_allocated = class->obj_allocated;
+		obj_used = class->obj_used;
+		pages_used = class->pages_allocated;
+		compacted = class->pages_compacted;
+		spin_unlock(&class->lock);
+
+		seq_printf(s, " %5d %5d %11lu %12lu %13lu %10lu %10lu %16d %9lu\n",
+			i, class->size, almost_full, almost_empty,
+			obj_allocated, obj_used, pages_used,
+			class->pages_per_zspage, compacted);
+
+		total_objs += obj_allocated;
+		total_used_objs += obj_used;
+		total_pages += pages_used;
+		total_compacted += compacted;
+	}
+
+	seq_puts(s, "\n");
+	seq_printf(s, " %5s %5s %11s %12s %13lu %10lu %10lu %16s %9lu\n",
+			"Total", "", "", "", total_objs, total_used_objs,
+			total_pages, "", total_compacted);
+
+	return 0;
+}
+
+static int zs_stats_size_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_size_show, inode->i_private);
+}
+
+static const struct file_operations zs_stat_size_ops = {
+	.open           = zs_stats_size_open,
+	.read           = seq_read,
+	.llseek         = seq_lseek,
+	.release        = single_release,
+};
+
+static void zs_pool_stat_create(struct zs_pool *pool)
+{
+	char name[20];
+
+	if (!zs_stat_root)
+		return;
+
+	snprintf(name, sizeof(name), "pool-%d",
+			atomic_inc_return(&zs_pool_id));
+	pool->stat_dentry = debugfs_create_dir(name, zs_stat_root);
+	if (!pool->stat_dentry)
+		return;
+
+	if (!debugfs_create_file("classes", S_IFREG | S_IRUGO,
+			pool->stat_dentry, pool, &zs_stat_size_ops)) {
+		debugfs_remove_recursive(pool->stat_dentry);
+		pool->stat_dentry = NULL;
+	}
+}
+
+static void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+	debugfs_remove_recursive(pool->stat_dentry);
+}
+
+#else 
+
+static inline int zs_stat_init(void)
+{
+	return 0;
+}
+
+static inline void zs_stat_exit(void)
+{
+}
+
+static inline void zs_pool_stat_create(struct zs_pool *pool)
+{
+}
+
+static inline void zs_pool_stat_destroy(struct zs_pool *pool)
+{
+}
+
+#endif
+
 static void zs_exit(void)
 {
 	int cpu;
@@ -598,24 +890,263 @@ static void zs_exit(void)
 	for_each_online_cpu(cpu)
 		zs_cpu_notifier(NULL, CPU_DEAD, (void *)(long)cpu);
 	unregister_cpu_notifier(&zs_cpu_nb);
+
+	zs_stat_exit();
+	if (zs_handle_cache)
+		kmem_cache_destroy(zs_handle_cache);
 }
 
 static int zs_init(void)
 {
 	int cpu, ret;
 
+	zs_handle_cache = kmem_cache_create("zs_handle", sizeof(unsigned long),
+					0, 0, NULL);
+	if (!zs_handle_cache)
+		return -ENOMEM;
+
 	register_cpu_notifier(&zs_cpu_nb);
 	for_each_online_cpu(cpu) {
 		ret = zs_cpu_notifier(NULL, CPU_UP_PREPARE, (void *)(long)cpu);
 		if (notifier_to_errno(ret))
 			goto fail;
 	}
+
+	zs_stat_init();
 	return 0;
 fail:
 	zs_exit();
 	return notifier_to_errno(ret);
 }
 
+static void zs_object_copy(unsigned long dst, unsigned long src,
+				struct size_class *class)
+{
+	struct page *s_page, *d_page;
+	unsigned long s_objidx, d_objidx;
+	unsigned long s_off, d_off;
+	void *s_addr, *d_addr;
+	int s_size, d_size, size;
+	int written = 0;
+
+	s_size = d_size = class->size;
+
+	obj_to_location(src, &s_page, &s_objidx);
+	obj_to_location(dst, &d_page, &d_objidx);
+
+	s_off = obj_idx_to_offset(s_page, s_objidx, class->size);
+	d_off = obj_idx_to_offset(d_page, d_objidx, class->size);
+
+	if (s_off + class->size > PAGE_SIZE)
+		s_size = PAGE_SIZE - s_off;
+
+	if (d_off + class->size > PAGE_SIZE)
+		d_size = PAGE_SIZE - d_off;
+
+	s_addr = kmap_atomic(s_page);
+	d_addr = kmap_atomic(d_page);
+
+	while (1) {
+		size = min(s_size, d_size);
+		memcpy(d_addr + d_off, s_addr + s_off, size);
+		written += size;
+
+		if (written == class->size)
+			break;
+
+		s_off += size;
+		s_size -= size;
+		d_off += size;
+		d_size -= size;
+
+		if (s_off >= PAGE_SIZE) {
+			kunmap_atomic(d_addr);
+			kunmap_atomic(s_addr);
+			s_page = get_next_page(s_page);
+			BUG_ON(!s_page);
+			s_addr = kmap_atomic(s_page);
+			d_addr = kmap_atomic(d_page);
+			s_size = class->size - written;
+			s_off = 0;
+		}
+
+		if (d_off >= PAGE_SIZE) {
+			kunmap_atomic(d_addr);
+			d_page = get_next_page(d_page);
+			BUG_ON(!d_page);
+			d_addr = kmap_atomic(d_page);
+			d_size = class->size - written;
+			d_off = 0;
+		}
+	}
+
+	kunmap_atomic(d_addr);
+	kunmap_atomic(s_addr);
+}
+
+static struct page *isolate_zspage(struct size_class *class,
+				enum fullness_group fullness)
+{
+	struct page *page = class->fullness_list[fullness];
+
+	if (page)
+		remove_zspage(page, class, fullness);
+
+	return page;
+}
+
+static void putback_zspage(struct size_class *class, struct page *first_page)
+{
+	enum fullness_group fullness = get_fullness_group(first_page);
+
+	insert_zspage(first_page, class, fullness);
+	set_zspage_mapping(first_page, class->index, fullness);
+}
+
+/*
+ * Move live objects from src_page into dst_page until src_page is empty or
+ * dst_page is full.  Objects pinned by a mapping or a concurrent free are
+ * skipped; -EBUSY is returned if any were left behind once all of src_page
+ * has been walked, since src_page can then not be released.
+ */
+static int migrate_zspage(struct size_class *class, struct page *src_page,
+				struct page *dst_page)
+{
+	unsigned long *handles = zspage_handles(src_page);
+	unsigned long handle, obj, new_obj;
+	unsigned int slot;
+	int ret = 0;
+
+	for (slot = 0; slot < src_page->objects && src_page->inuse; slot++) {
+		handle = handles[slot];
+		if (!handle)
+			continue;
+
+		if (dst_page->inuse == dst_page->objects)
+			return 0;
+
+		if (!trypin_tag(handle)) {
+			ret = -EBUSY;
+			continue;
+		}
+
+		obj = handle_to_obj(handle);
+		BUG_ON(obj != slot_to_obj(src_page, slot, class->size));
+
+		new_obj = obj_malloc(class, dst_page, handle);
+		zs_object_copy(new_obj, obj, class);
+		/* publish the new location without dropping the pin */
+		*(unsigned long *)handle = (new_obj << OBJ_TAG_BITS) |
+						(1UL << HANDLE_PIN_BIT);
+		obj_free(class, obj);
+		unpin_tag(handle);
+	}
+
+	return ret;
+}
+
+/* number of pages that could be freed by packing the class tightly */
+static unsigned long zs_can_compact(struct size_class *class)
+{
+	unsigned long obj_wasted;
+
+	if (class->obj_allocated <= class->obj_used)
+		return 0;
+
+	obj_wasted = class->obj_allocated - class->obj_used;
+	obj_wasted /= class->objs_per_zspage;
+
+	return obj_wasted * class->pages_per_zspage;
+}
+
+static unsigned long __zs_compact(struct zs_pool *pool,
+				struct size_class *class,
+				unsigned long nr_to_free)
+{
+	struct page *src_page, *dst_page;
+	unsigned long freed = 0;
+	int ret;
+
+	spin_lock(&class->lock);
+	while (freed < nr_to_free && zs_can_compact(class)) {
+		src_page = isolate_zspage(class, ZS_ALMOST_EMPTY);
+		if (!src_page)
+			break;
+
+		ret = 0;
+		while (src_page->inuse && !ret) {
+			dst_page = isolate_zspage(class, ZS_ALMOST_FULL);
+			if (!dst_page)
+				dst_page = isolate_zspage(class, ZS_ALMOST_EMPTY);
+			if (!dst_page)
+				break;
+
+			ret = migrate_zspage(class, src_page, dst_page);
+			putback_zspage(class, dst_page);
+		}
+
+		if (src_page->inuse) {
+			putback_zspage(class, src_page);
+			break;
+		}
+
+		class->pages_allocated -= class->pages_per_zspage;
+		class->obj_allocated -= class->objs_per_zspage;
+		class->pages_compacted += class->pages_per_zspage;
+		freed += class->pages_per_zspage;
+		spin_unlock(&class->lock);
+
+		free_zspage(src_page);
+		cond_resched();
+
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+static unsigned long zs_compact_pages(struct zs_pool *pool,
+				      unsigned long nr_to_free)
+{
+	int i;
+	unsigned long freed = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0 && freed < nr_to_free; i--)
+		freed += __zs_compact(pool, &pool->size_class[i],
+				      nr_to_free - freed);
+
+	atomic_long_add(freed, &pool->pages_compacted);
+
+	return freed;
+}
+
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	return zs_compact_pages(pool, ULONG_MAX);
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+static int zs_shrinker_shrink(struct shrinker *shrinker,
+				struct shrink_control *sc)
+{
+	int i;
+	unsigned long pages = 0, freed;
+	struct zs_pool *pool = container_of(shrinker, struct zs_pool,
+					shrinker);
+
+	if (sc->nr_to_scan) {
+		freed = zs_compact_pages(pool, sc->nr_to_scan);
+		if (current->reclaim_state)
+			current->reclaim_state->reclaimed_slab += freed;
+	}
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		pages += zs_can_compact(&pool->size_class[i]);
+
+	return min_t(unsigned long, pages, INT_MAX);
+}
+
 struct zs_pool *zs_create_pool(gfp_t flags)
 {
 	int i, ovhd_size;
@@ -639,10 +1170,19 @@ struct zs_pool *zs_create_pool(gfp_t flags)
 		class->index = i;
 		spin_lock_init(&class->lock);
 		class->pages_per_zspage = get_pages_per_zspage(size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / size;
 
 	}
 
 	pool->flags = flags;
+	atomic_long_set(&pool->pages_compacted, 0);
+
+	pool->shrinker.shrink = zs_shrinker_shrink;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&pool->shrinker);
+
+	zs_pool_stat_create(pool);
 
 	return pool;
 }
@@ -652,6 +1192,9 @@ void zs_destroy_pool(struct zs_pool *pool)
 {
 	int i;
 
+	zs_pool_stat_destroy(pool);
+	unregister_shrinker(&pool->shrinker);
+
 	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
 		int fg;
 		struct size_class *class = &pool->size_class[i];
@@ -669,17 +1212,19 @@ EXPORT_SYMBOL_GPL(zs_destroy_pool);
 
 unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 {
-	unsigned long obj;
-	struct link_free *link;
+	unsigned long handle, obj;
 	int class_idx;
 	struct size_class *class;
-
-	struct page *first_page, *m_page;
-	unsigned long m_objidx, m_offset;
+	struct page *first_page;
 
 	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
 		return 0;
 
+	handle = (unsigned long)kmem_cache_alloc(zs_handle_cache,
+				pool->flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+
 	class_idx = get_size_class_index(size);
 	class = &pool->size_class[class_idx];
 	BUG_ON(class_idx != class->index);
@@ -690,69 +1235,60 @@ unsigned long zs_malloc(struct zs_pool *pool, size_t size)
 	if (!first_page) {
 		spin_unlock(&class->lock);
 		first_page = alloc_zspage(class, pool->flags);
-		if (unlikely(!first_page))
+		if (unlikely(!first_page)) {
+			kmem_cache_free(zs_handle_cache, (void *)handle);
 			return 0;
+		}
 
 		set_zspage_mapping(first_page, class->index, ZS_EMPTY);
 		spin_lock(&class->lock);
 		class->pages_allocated += class->pages_per_zspage;
+		class->obj_allocated += class->objs_per_zspage;
 	}
 
-	obj = (unsigned long)first_page->freelist;
-	obj_handle_to_location(obj, &m_page, &m_objidx);
-	m_offset = obj_idx_to_offset(m_page, m_objidx, class->size);
-
-	link = (struct link_free *)kmap_atomic(m_page) +
-					m_offset / sizeof(*link);
-	first_page->freelist = link->next;
-	memset(link, POISON_INUSE, sizeof(*link));
-	kunmap_atomic(link);
+	obj = obj_malloc(class, first_page, handle);
+	record_obj(handle, obj);
 
-	first_page->inuse++;
 	
 	fix_fullness_group(pool, first_page);
 	spin_unlock(&class->lock);
 
-	return obj;
+	return handle;
 }
 EXPORT_SYMBOL_GPL(zs_malloc);
 
-void zs_free(struct zs_pool *pool, unsigned long obj)
+void zs_free(struct zs_pool *pool, unsigned long handle)
 {
-	struct link_free *link;
 	struct page *first_page, *f_page;
-	unsigned long f_objidx, f_offset;
+	unsigned long obj, f_objidx;
 
 	int class_idx;
 	struct size_class *class;
 	enum fullness_group fullness;
 
-	if (unlikely(!obj))
+	if (unlikely(!handle))
 		return;
 
-	obj_handle_to_location(obj, &f_page, &f_objidx);
+	pin_tag(handle);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &f_page, &f_objidx);
 	first_page = get_first_page(f_page);
 
 	get_zspage_mapping(first_page, &class_idx, &fullness);
 	class = &pool->size_class[class_idx];
-	f_offset = obj_idx_to_offset(f_page, f_objidx, class->size);
 
 	spin_lock(&class->lock);
-
-	
-	link = (struct link_free *)((unsigned char *)kmap_atomic(f_page)
-							+ f_offset);
-	link->next = first_page->freelist;
-	kunmap_atomic(link);
-	first_page->freelist = (void *)obj;
-
-	first_page->inuse--;
+	obj_free(class, obj);
 	fullness = fix_fullness_group(pool, first_page);
 
-	if (fullness == ZS_EMPTY)
+	if (fullness == ZS_EMPTY) {
 		class->pages_allocated -= class->pages_per_zspage;
+		class->obj_allocated -= class->objs_per_zspage;
+	}
 
 	spin_unlock(&class->lock);
+	unpin_tag(handle);
+	kmem_cache_free(zs_handle_cache, (void *)handle);
 
 	if (fullness == ZS_EMPTY)
 		free_zspage(first_page);
@@ -763,7 +1299,7 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 			enum zs_mapmode mm)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
@@ -775,7 +1311,11 @@ void *zs_map_object(struct zs_pool *pool, unsigned long handle,
 
 	BUG_ON(in_interrupt());
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	/* keeps compaction from moving the object until zs_unmap_object() */
+	pin_tag(handle);
+
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -800,7 +1340,7 @@ EXPORT_SYMBOL_GPL(zs_map_object);
 void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 {
 	struct page *page;
-	unsigned long obj_idx, off;
+	unsigned long obj, obj_idx, off;
 
 	unsigned int class_idx;
 	enum fullness_group fg;
@@ -809,7 +1349,8 @@ void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 
 	BUG_ON(!handle);
 
-	obj_handle_to_location(handle, &page, &obj_idx);
+	obj = handle_to_obj(handle);
+	obj_to_location(obj, &page, &obj_idx);
 	get_zspage_mapping(get_first_page(page), &class_idx, &fg);
 	class = &pool->size_class[class_idx];
 	off = obj_idx_to_offset(page, obj_idx, class->size);
@@ -827,6 +1368,7 @@ void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
 		__zs_unmap_object(area, pages, off, class->size);
 	}
 	put_cpu_var(zs_map_area);
+	unpin_tag(handle);
 }
 EXPORT_SYMBOL_GPL(zs_unmap_object);
 
@@ -842,6 +1384,12 @@ u64 zs_get_total_size_bytes(struct zs_pool *pool)
 }
 EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
 
+unsigned long zs_get_pages_compacted(struct zs_pool *pool)
+{
+	return atomic_long_read(&pool->pages_compacted);
+}
+EXPORT_SYMBOL_GPL(zs_get_pages_compacted);
+
 module_init(zs_init);
 module_exit(zs_exit);
 
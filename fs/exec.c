@@ -809,6 +809,7 @@ static int de_thread(struct task_struct *tsk)
 		write_unlock_irq(&tasklist_lock);
 
 		release_task(leader);
+		oom_score_adj_notify(tsk);
 	}
 
 	sig->group_exit_task = NULL;
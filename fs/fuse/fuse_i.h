@@ -25,10 +25,16 @@
 
 #define FUSE_MAX_PAGES_PER_REQ 32
 
+#define FUSE_MAX_MAX_PAGES 256
+
+#define FUSE_REQ_INLINE_PAGES FUSE_MAX_PAGES_PER_REQ
+
 #define FUSE_NOWRITE INT_MIN
 
 #define FUSE_NAME_MAX 1024
 
+#define FUSE_SUPER_MAGIC 0x65735546
+
 #define FUSE_CTL_NUM_DENTRIES 5
 
 #define FUSE_DEFAULT_PERMISSIONS (1 << 0)
@@ -117,6 +123,10 @@ struct fuse_file {
 
 	
 	bool flock:1;
+
+	/* Backing file that read, write and mmap are redirected to */
+	struct file *passthrough_filp;
+	const struct cred *passthrough_cred;
 };
 
 struct fuse_in_arg {
@@ -246,7 +256,17 @@ struct fuse_req {
 	} misc;
 
 	
-	struct page *pages[FUSE_MAX_PAGES_PER_REQ];
+	struct page **pages;
+
+	
+	unsigned max_pages;
+
+	
+	struct page *inline_pages[FUSE_REQ_INLINE_PAGES];
+
+	
+	struct file *passthrough_filp;
+	const struct cred *passthrough_cred;
 
 	
 	unsigned num_pages;
@@ -296,6 +316,9 @@ struct fuse_conn {
 	unsigned max_write;
 
 	
+	unsigned max_pages;
+
+	
 	wait_queue_head_t waitq;
 
 	
@@ -414,6 +437,15 @@ struct fuse_conn {
 	
 	unsigned dont_mask:1;
 
+	/*
+	 * Cache dirty pages of regular files and write them back in
+	 * batches; the kernel's i_size is authoritative while they exist.
+	 */
+	unsigned writeback_cache:1;
+
+	
+	unsigned passthrough:1;
+
 	
 	unsigned no_flock:1;
 
@@ -541,12 +573,14 @@ void fuse_ctl_cleanup(void);
 
 struct fuse_req *fuse_request_alloc(void);
 
-struct fuse_req *fuse_request_alloc_nofs(void);
+struct fuse_req *fuse_request_alloc_nofs(unsigned npages);
 
 void fuse_request_free(struct fuse_req *req);
 
 struct fuse_req *fuse_get_req(struct fuse_conn *fc);
 
+struct fuse_req *fuse_get_req_pages(struct fuse_conn *fc, unsigned npages);
+
 struct fuse_req *fuse_get_req_nofail(struct fuse_conn *fc, struct file *file);
 
 void fuse_put_request(struct fuse_conn *fc, struct fuse_req *req);
@@ -611,4 +645,15 @@ int fuse_dev_release(struct inode *inode, struct file *file);
 
 void fuse_write_update_size(struct inode *inode, loff_t pos);
 
+bool fuse_size_is_local(struct inode *inode);
+
+void fuse_passthrough_fget(struct fuse_conn *fc, struct fuse_req *req);
+void fuse_passthrough_put_req(struct fuse_req *req);
+void fuse_passthrough_setup(struct fuse_file *ff, struct fuse_req *req,
+			    fmode_t mode, unsigned int flags);
+void fuse_passthrough_release(struct fuse_file *ff);
+ssize_t fuse_passthrough_aio_rw(struct kiocb *iocb, const struct iovec *iov,
+				unsigned long nr_segs, loff_t pos, int write);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif 
@@ -0,0 +1,165 @@
+/*
+  FUSE: Filesystem in Userspace
+  Copyright (C) 2001-2008  Miklos Szeredi <miklos@szeredi.hu>
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/file.h>
+#include <linux/fsnotify.h>
+#include <linux/aio.h>
+#include <linux/uio.h>
+#include <linux/cred.h>
+#include <linux/pagemap.h>
+
+/*
+ * Called from the daemon's write to /dev/fuse, before the opener is
+ * woken, so the descriptor is looked up in the daemon's file table.
+ */
+void fuse_passthrough_fget(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_open_out *outarg;
+	struct file *lower;
+	struct inode *inode;
+
+	if (!fc->passthrough)
+		return;
+
+	if (req->in.h.opcode == FUSE_OPEN)
+		outarg = req->out.args[0].value;
+	else if (req->in.h.opcode == FUSE_CREATE)
+		outarg = req->out.args[1].value;
+	else
+		return;
+
+	if (!(outarg->open_flags & FOPEN_PASSTHROUGH))
+		return;
+	outarg->open_flags &= ~FOPEN_PASSTHROUGH;
+
+	lower = fget(outarg->passthrough_fd);
+	if (!lower)
+		return;
+
+	inode = lower->f_path.dentry->d_inode;
+	if (!S_ISREG(inode->i_mode) ||
+	    inode->i_sb->s_magic == FUSE_SUPER_MAGIC ||
+	    !lower->f_op || !lower->f_op->aio_read ||
+	    !lower->f_op->aio_write) {
+		fput(lower);
+		return;
+	}
+
+	req->passthrough_filp = lower;
+	req->passthrough_cred = get_current_cred();
+}
+
+void fuse_passthrough_put_req(struct fuse_req *req)
+{
+	if (req->passthrough_filp) {
+		fput(req->passthrough_filp);
+		put_cred(req->passthrough_cred);
+		req->passthrough_filp = NULL;
+		req->passthrough_cred = NULL;
+	}
+}
+
+void fuse_passthrough_setup(struct fuse_file *ff, struct fuse_req *req,
+			    fmode_t mode, unsigned int flags)
+{
+	struct file *lower = req->passthrough_filp;
+
+	if (!lower)
+		return;
+
+	if (((mode & FMODE_READ) && !(lower->f_mode & FMODE_READ)) ||
+	    ((mode & FMODE_WRITE) && !(lower->f_mode & FMODE_WRITE)) ||
+	    ((flags ^ lower->f_flags) & O_APPEND))
+		return;
+
+	ff->passthrough_filp = lower;
+	ff->passthrough_cred = req->passthrough_cred;
+	req->passthrough_filp = NULL;
+	req->passthrough_cred = NULL;
+}
+
+void fuse_passthrough_release(struct fuse_file *ff)
+{
+	if (ff->passthrough_filp) {
+		fput(ff->passthrough_filp);
+		put_cred(ff->passthrough_cred);
+		ff->passthrough_filp = NULL;
+		ff->passthrough_cred = NULL;
+	}
+}
+
+ssize_t fuse_passthrough_aio_rw(struct kiocb *iocb, const struct iovec *iov,
+				unsigned long nr_segs, loff_t pos, int write)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough_filp;
+	struct inode *inode = file->f_mapping->host;
+	const struct cred *old_cred;
+	struct kiocb lower_iocb;
+	ssize_t ret;
+
+	init_sync_kiocb(&lower_iocb, lower);
+	lower_iocb.ki_pos = pos;
+	lower_iocb.ki_left = iov_length(iov, nr_segs);
+	lower_iocb.ki_nbytes = lower_iocb.ki_left;
+
+	old_cred = override_creds(ff->passthrough_cred);
+	if (write)
+		ret = lower->f_op->aio_write(&lower_iocb, iov, nr_segs, pos);
+	else
+		ret = lower->f_op->aio_read(&lower_iocb, iov, nr_segs, pos);
+	if (ret == -EIOCBQUEUED)
+		ret = wait_on_sync_kiocb(&lower_iocb);
+	revert_creds(old_cred);
+
+	if (ret <= 0)
+		return ret;
+
+	iocb->ki_pos = lower_iocb.ki_pos;
+	if (write) {
+		fsnotify_modify(lower);
+		fuse_write_update_size(inode, iocb->ki_pos);
+		if (inode->i_mapping->nrpages)
+			invalidate_mapping_pages(inode->i_mapping,
+					(iocb->ki_pos - ret) >> PAGE_CACHE_SHIFT,
+					(iocb->ki_pos - 1) >> PAGE_CACHE_SHIFT);
+		fuse_invalidate_attr(inode);
+	} else {
+		fsnotify_access(lower);
+	}
+
+	return ret;
+}
+
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough_filp;
+	const struct cred *old_cred;
+	int ret;
+
+	if (!lower->f_op->mmap)
+		return -ENODEV;
+
+	get_file(lower);
+	vma->vm_file = lower;
+	old_cred = override_creds(ff->passthrough_cred);
+	ret = lower->f_op->mmap(lower, vma);
+	revert_creds(old_cred);
+	if (ret) {
+		vma->vm_file = file;
+		fput(lower);
+		return ret;
+	}
+	fput(file);
+	file_accessed(file);
+	return 0;
+}
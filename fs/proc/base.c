@@ -919,6 +919,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		oom_score_adj_notify(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
@@ -1037,6 +1039,8 @@ err_sighand:
 	unlock_task_sighand(task, &flags);
 err_task_lock:
 	task_unlock(task);
+	if (!err)
+		oom_score_adj_notify(task);
 	put_task_struct(task);
 out:
 	return err < 0 ? err : count;
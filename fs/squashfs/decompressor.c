@@ -82,6 +82,7 @@ const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
 void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 {
 	struct squashfs_sb_info *msblk = sb->s_fs_info;
+	struct squashfs_page_actor actor;
 	void *strm, *buffer = NULL;
 	int length = 0;
 
@@ -90,9 +91,9 @@ void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 		if (buffer == NULL)
 			return ERR_PTR(-ENOMEM);
 
-		length = squashfs_read_data(sb, &buffer,
-			sizeof(struct squashfs_super_block), 0, NULL,
-			PAGE_CACHE_SIZE, 1);
+		squashfs_page_actor_init(&actor, &buffer, 1, PAGE_CACHE_SIZE);
+		length = squashfs_read_data(sb,
+			sizeof(struct squashfs_super_block), 0, NULL, &actor);
 
 		if (length < 0) {
 			strm = ERR_PTR(length);
@@ -100,7 +101,7 @@ void *squashfs_decompressor_init(struct super_block *sb, unsigned short flags)
 		}
 	}
 
-	strm = msblk->decompressor->init(msblk, buffer, length);
+	strm = msblk->thread_ops->create(msblk, buffer, length);
 
 finished:
 	kfree(buffer);
@@ -27,8 +27,10 @@
 
 #define WARNING(s, args...)	pr_warning("SQUASHFS: "s, ## args)
 
-extern int squashfs_read_data(struct super_block *, void **, u64, int, u64 *,
-				int, int);
+struct squashfs_page_actor;
+
+extern int squashfs_read_data(struct super_block *, u64, int, u64 *,
+				struct squashfs_page_actor *);
 
 extern struct squashfs_cache *squashfs_cache_init(char *, int, int);
 extern void squashfs_cache_delete(struct squashfs_cache *);
@@ -62,6 +64,11 @@ extern struct inode *squashfs_iget(struct super_block *, long long,
 				unsigned int);
 extern int squashfs_read_inode(struct inode *, long long);
 
+extern void squashfs_copy_cache(struct page *, struct squashfs_cache_entry *,
+				int, int);
+
+extern int squashfs_readpage_block(struct page *, u64, int, int);
+
 extern ssize_t squashfs_listxattr(struct dentry *, char *, size_t);
 
 
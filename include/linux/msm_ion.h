@@ -123,6 +123,23 @@ struct ion_cma_pdata {
 	unsigned long default_prefetch_size;
 };
 
+/**
+ * struct ion_system_heap_pdata - platform data for the system heap
+ * @orders:		page orders to allocate from, strictly descending
+ *			and ending in 0; NULL selects {8, 4, 0}
+ * @num_orders:		number of entries in @orders
+ * @fail_backoff_ms:	how long an order is served only from the pools
+ *			after the page allocator failed it; 0 means 1000
+ * @compact_on_fail:	when an order fails, refill its pool from a worker
+ *			that is allowed to compact memory
+ */
+struct ion_system_heap_pdata {
+	const unsigned int *orders;
+	int num_orders;
+	unsigned int fail_backoff_ms;
+	int compact_on_fail;
+};
+
 #ifdef CONFIG_ION
 
 struct ion_client *msm_ion_client_create(unsigned int heap_mask,
@@ -117,6 +117,14 @@ enum {
 #define COUNT_CONTINUED	0x80	
 #define SWAP_MAP_SHMEM	0xbf	
 
+/*
+ * Count updates on a swap_map entry take the lock of the cluster the entry
+ * lies in; si->lock is still needed to allocate an entry or free it for good.
+ */
+struct swap_cluster_info {
+	spinlock_t lock;
+};
+
 struct swap_info_struct {
 	unsigned long	flags;		
 	signed short	prio;		
@@ -137,7 +145,9 @@ struct swap_info_struct {
 	struct block_device *bdev;	
 	struct file *swap_file;		
 	unsigned int old_block_size;	
+	struct swap_cluster_info *cluster_info;
 	spinlock_t lock;		
+	spinlock_t cont_lock;		
 };
 
 struct swap_list_t {
@@ -277,6 +287,8 @@ static inline long get_nr_swap_pages(void)
 
 extern void si_swapinfo(struct sysinfo *);
 extern swp_entry_t get_swap_page(void);
+extern int get_swap_pages(int, swp_entry_t []);
+extern bool has_usable_swap(void);
 extern swp_entry_t get_swap_page_of_type(int);
 extern int add_swap_count_continuation(swp_entry_t, gfp_t);
 extern void swap_shmem_alloc(swp_entry_t);
@@ -284,12 +296,14 @@ extern int swap_duplicate(swp_entry_t);
 extern int swapcache_prepare(swp_entry_t);
 extern void swap_free(swp_entry_t);
 extern void swapcache_free(swp_entry_t, struct page *page);
+extern void swapcache_free_entries(swp_entry_t *, int);
 extern int free_swap_and_cache(swp_entry_t);
 extern int swap_type_of(dev_t, sector_t, struct block_device **);
 extern unsigned int count_swap_pages(int, int);
 extern sector_t map_swap_page(struct page *, struct block_device **);
 extern sector_t swapdev_block(int, pgoff_t);
 extern int page_swapcount(struct page *);
+extern int __swp_swapcount(swp_entry_t);
 extern struct swap_info_struct *page_swap_info(struct page *);
 extern int reuse_swap_page(struct page *);
 extern int try_to_free_swap(struct page *);
@@ -19,6 +19,7 @@
 #include <linux/kref.h>
 #include <linux/ktime.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/spinlock.h>
 #include <linux/wait.h>
 
@@ -74,8 +75,13 @@ struct sync_timeline {
 	struct list_head	child_list_head;
 	spinlock_t		child_list_lock;
 
-	struct list_head	active_list_head;
-	spinlock_t		active_list_lock;
+	/*
+	 * Active points ordered by ops->compare().  Timelines signal in
+	 * order, so sync_timeline_signal() only visits the leftmost points
+	 * up to the first one that has not signaled yet.
+	 */
+	struct rb_root		active_tree;
+	spinlock_t		active_lock;
 
 	struct list_head	sync_timeline_list;
 };
@@ -84,7 +90,7 @@ struct sync_pt {
 	struct sync_timeline		*parent;
 	struct list_head	child_list;
 
-	struct list_head	active_list;
+	struct rb_node		active_node;
 	struct list_head	signaled_list;
 
 	struct sync_fence	*fence;
@@ -110,7 +116,9 @@ struct sync_fence {
 
 	wait_queue_head_t	wq;
 
+#ifdef CONFIG_SYNC_FENCE_LIST
 	struct list_head	sync_fence_list;
+#endif
 };
 
 struct sync_fence_waiter;
@@ -0,0 +1,18 @@
+#ifndef __LINUX_VMPRESSURE_H
+#define __LINUX_VMPRESSURE_H
+
+#include <linux/gfp.h>
+#include <linux/notifier.h>
+
+/*
+ * Global reclaim pressure.  Reclaim efficiency is sampled every
+ * vmpressure window and the notifier chain is called with the pressure,
+ * 0 (every scanned page was reclaimed) to 100 (nothing was reclaimed),
+ * as its action value.
+ */
+extern void vmpressure(gfp_t gfp, unsigned long scanned,
+		       unsigned long reclaimed);
+extern int vmpressure_notifier_register(struct notifier_block *nb);
+extern int vmpressure_notifier_unregister(struct notifier_block *nb);
+
+#endif
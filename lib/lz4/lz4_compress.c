@@ -0,0 +1,172 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ * Copyright (C) 2011-2012, Yann Collet.
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * You can contact the author at :
+ * - LZ4 homepage : http://fastcompression.blogspot.com/p/lz4.html
+ * - LZ4 source repository : http://code.google.com/p/lz4/
+ *
+ *  Changed for kernel use by:
+ *  Chanho Min <chanho.min@lge.com>
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline u8 *lz4_put_length(u8 *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = (u8)len;
+	return op;
+}
+
+static inline size_t lz4_count(const u8 *ip, const u8 *ref,
+			       const u8 *const limit)
+{
+	const u8 *const start = ip;
+
+	while (ip + sizeof(unsigned long) <= limit) {
+		unsigned long diff = lz4_read_word(ip) ^ lz4_read_word(ref);
+
+		if (diff)
+			return ip - start + lz4_nb_common_bytes(diff);
+		ip += sizeof(unsigned long);
+		ref += sizeof(unsigned long);
+	}
+	while (ip < limit && *ip == *ref) {
+		ip++;
+		ref++;
+	}
+	return ip - start;
+}
+
+static size_t lz4_compressctx(u32 *hashtable, const u8 *source, size_t isize,
+			      u8 *dest)
+{
+	const u8 *ip = source;
+	const u8 *anchor = source;
+	const u8 *const iend = source + isize;
+	const u8 *const mflimit = iend - MFLIMIT;
+	const u8 *const matchlimit = iend - LASTLITERALS;
+	u8 *op = dest;
+	u8 *token;
+	size_t length;
+
+	if (isize < MINLENGTH)
+		goto last_literals;
+
+	hashtable[lz4_hash(lz4_read32(ip))] = 0;
+	ip++;
+
+	while (ip < mflimit) {
+		u32 h = lz4_hash(lz4_read32(ip));
+		u32 cur = ip - source;
+		u32 cand = hashtable[h];
+		const u8 *ref;
+
+		hashtable[h] = cur;
+
+		/*
+		 * The table is not cleared between calls, so a candidate may
+		 * point anywhere: only trust it if it lies behind ip, within
+		 * reach, and really matches.
+		 */
+		if (cand >= cur || cur - cand > MAX_DISTANCE ||
+		    lz4_read32(source + cand) != lz4_read32(ip)) {
+			ip += 1 + ((ip - anchor) >> SKIPSTRENGTH);
+			continue;
+		}
+		ref = source + cand;
+
+		while (ip > anchor && ref > source && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		length = ip - anchor;
+		token = op++;
+		if (length >= RUN_MASK) {
+			*token = RUN_MASK << ML_BITS;
+			op = lz4_put_length(op, length - RUN_MASK);
+		} else {
+			*token = length << ML_BITS;
+		}
+		memcpy(op, anchor, length);
+		op += length;
+
+		put_unaligned_le16(ip - ref, op);
+		op += 2;
+
+		ip += MINMATCH;
+		ref += MINMATCH;
+		length = lz4_count(ip, ref, matchlimit);
+		ip += length;
+
+		if (length >= ML_MASK) {
+			*token += ML_MASK;
+			op = lz4_put_length(op, length - ML_MASK);
+		} else {
+			*token += length;
+		}
+
+		anchor = ip;
+		if (ip < mflimit)
+			hashtable[lz4_hash(lz4_read32(ip - 2))] =
+				ip - 2 - source;
+	}
+
+last_literals:
+	length = iend - anchor;
+	if (length >= RUN_MASK) {
+		*op++ = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, length - RUN_MASK);
+	} else {
+		*op++ = length << ML_BITS;
+	}
+	memcpy(op, anchor, length);
+	op += length;
+
+	return op - dest;
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	if (!src_len)
+		return -1;
+
+	*dst_len = lz4_compressctx(wrkmem, src, src_len, dst);
+	return 0;
+}
+EXPORT_SYMBOL(lz4_compress);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("LZ4 compressor");
@@ -0,0 +1,104 @@
+/*
+ * LZ4 Decompressor for Linux kernel
+ *
+ * Copyright (C) 2013, LG Electronics, Kyungsik Lee <kyungsik.lee@lge.com>
+ *
+ * Based on LZ4 implementation by Yann Collet.
+ *
+ * LZ4 - Fast LZ compression algorithm
+ * Copyright (C) 2011-2012, Yann Collet.
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+static inline int lz4_get_length(const u8 **ip, const u8 *const iend,
+				 size_t *length)
+{
+	unsigned int s;
+
+	do {
+		if (unlikely(*ip >= iend))
+			return -1;
+		s = *(*ip)++;
+		*length += s;
+	} while (s == 255);
+
+	return 0;
+}
+
+static int lz4_uncompress_unknownoutputsize(const u8 *source, u8 *dest,
+					    size_t isize, size_t *osize)
+{
+	const u8 *ip = source;
+	const u8 *const iend = source + isize;
+	u8 *op = dest;
+	u8 *const oend = dest + *osize;
+	const u8 *ref;
+	unsigned int token;
+	size_t length, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		length = token >> ML_BITS;
+		if (length == RUN_MASK && lz4_get_length(&ip, iend, &length))
+			return -1;
+
+		if (unlikely(length > (size_t)(iend - ip) ||
+			     length > (size_t)(oend - op)))
+			return -1;
+		memcpy(op, ip, length);
+		op += length;
+		ip += length;
+
+		/* the last sequence carries literals only */
+		if (ip == iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			return -1;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > (size_t)(op - dest)))
+			return -1;
+
+		length = token & ML_MASK;
+		if (length == ML_MASK && lz4_get_length(&ip, iend, &length))
+			return -1;
+		length += MINMATCH;
+
+		if (unlikely(length > (size_t)(oend - op)))
+			return -1;
+
+		ref = op - offset;
+		if (offset >= length) {
+			memcpy(op, ref, length);
+			op += length;
+		} else {
+			while (length--)
+				*op++ = *ref++;
+		}
+	}
+
+	*osize = op - dest;
+	return 0;
+}
+
+int lz4_decompress_unknownoutputsize(const unsigned char *src, size_t src_len,
+		unsigned char *dest, size_t *dest_len)
+{
+	return lz4_uncompress_unknownoutputsize(src, dest, src_len, dest_len);
+}
+EXPORT_SYMBOL(lz4_decompress_unknownoutputsize);
+
+MODULE_LICENSE("Dual BSD/GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
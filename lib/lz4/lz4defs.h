@@ -0,0 +1,56 @@
+/*
+ * lz4defs.h -- architecture specific defines
+ *
+ * Copyright (C) 2013, LG Electronics, Kyungsik Lee <kyungsik.lee@lge.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <asm/unaligned.h>
+
+#define MINMATCH	4
+#define COPYLENGTH	8
+#define LASTLITERALS	5
+#define MFLIMIT		(COPYLENGTH + MINMATCH)
+#define MINLENGTH	(MFLIMIT + 1)
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+#define MAXD_LOG	16
+#define MAX_DISTANCE	((1 << MAXD_LOG) - 1)
+
+#define HASH_LOG	12
+#define HASHTABLESIZE	(1 << HASH_LOG)
+#define SKIPSTRENGTH	6
+
+static inline u32 lz4_read32(const u8 *p)
+{
+	return get_unaligned((const u32 *)p);
+}
+
+static inline unsigned long lz4_read_word(const u8 *p)
+{
+	return get_unaligned((const unsigned long *)p);
+}
+
+static inline u32 lz4_hash(u32 v)
+{
+	return (v * 2654435761U) >> (32 - HASH_LOG);
+}
+
+/* number of leading bytes equal in two words that differ */
+static inline unsigned int lz4_nb_common_bytes(unsigned long diff)
+{
+#ifdef __LITTLE_ENDIAN
+	return __ffs(diff) >> 3;
+#else
+	return (BITS_PER_LONG - 1 - __fls(diff)) >> 3;
+#endif
+}
@@ -430,6 +430,26 @@ int unregister_oom_notifier(struct notifier_block *nb)
 }
 EXPORT_SYMBOL_GPL(unregister_oom_notifier);
 
+static ATOMIC_NOTIFIER_HEAD(oom_score_adj_notify_list);
+
+int register_oom_score_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_register(&oom_score_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(register_oom_score_adj_notifier);
+
+int unregister_oom_score_adj_notifier(struct notifier_block *nb)
+{
+	return atomic_notifier_chain_unregister(&oom_score_adj_notify_list, nb);
+}
+EXPORT_SYMBOL_GPL(unregister_oom_score_adj_notifier);
+
+void oom_score_adj_notify(struct task_struct *task)
+{
+	atomic_notifier_call_chain(&oom_score_adj_notify_list,
+				   task->signal->oom_score_adj, task);
+}
+
 int try_set_zonelist_oom(struct zonelist *zonelist, gfp_t gfp_mask)
 {
 	struct zoneref *z;
@@ -11,6 +11,7 @@
 #include <linux/kernel_stat.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
+#include <linux/swap_slots.h>
 #include <linux/init.h>
 #include <linux/pagemap.h>
 #include <linux/backing-dev.h>
@@ -231,6 +232,12 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 		err = swapcache_prepare(entry);
 		if (err == -EEXIST) {	
 			radix_tree_preload_end();
+			/*
+			 * An unreferenced slot held in a swap slots cache
+			 * will not reach the swap cache; don't spin on it.
+			 */
+			if (swap_slot_cache_enabled && !__swp_swapcount(entry))
+				break;
 			continue;
 		}
 		if (err) {		
@@ -36,6 +36,7 @@
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
 #include <linux/swapops.h>
+#include <linux/swap_slots.h>
 #include <linux/page_cgroup.h>
 
 static bool swap_count_continued(struct swap_info_struct *, pgoff_t,
@@ -164,9 +165,25 @@ static int wait_for_discard(void *word)
 #define SWAPFILE_CLUSTER	256
 #define LATENCY_LIMIT		256
 
+static inline struct swap_cluster_info *lock_cluster(
+		struct swap_info_struct *si, unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	ci = si->cluster_info + offset / SWAPFILE_CLUSTER;
+	spin_lock(&ci->lock);
+	return ci;
+}
+
+static inline void unlock_cluster(struct swap_cluster_info *ci)
+{
+	spin_unlock(&ci->lock);
+}
+
 static unsigned long scan_swap_map(struct swap_info_struct *si,
 				   unsigned char usage)
 {
+	struct swap_cluster_info *ci;
 	unsigned long offset;
 	unsigned long scan_base;
 	unsigned long last_in_cluster = 0;
@@ -259,8 +276,13 @@ checks:
 		goto scan; 
 	}
 
-	if (si->swap_map[offset])
+	ci = lock_cluster(si, offset);
+	if (si->swap_map[offset]) {
+		unlock_cluster(ci);
 		goto scan;
+	}
+	si->swap_map[offset] = usage;
+	unlock_cluster(ci);
 
 	if (offset == si->lowest_bit)
 		si->lowest_bit++;
@@ -271,7 +293,6 @@ checks:
 		si->lowest_bit = si->max;
 		si->highest_bit = 0;
 	}
-	si->swap_map[offset] = usage;
 	si->cluster_next = offset + 1;
 	si->flags -= SWP_SCANNING;
 
@@ -346,18 +367,23 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+int get_swap_pages(int n_goal, swp_entry_t swp_entries[])
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
 	int hp_index;
+	int n_ret = 0;
+	long avail;
 
 	spin_lock(&swap_lock);
-	if (atomic_long_read(&nr_swap_pages) <= 0)
+	avail = atomic_long_read(&nr_swap_pages);
+	if (avail <= 0)
 		goto noswap;
-	atomic_long_dec(&nr_swap_pages);
+	if (n_goal > avail)
+		n_goal = avail;
+	atomic_long_sub(n_goal, &nr_swap_pages);
 
 	for (type = swap_list.next; type >= 0 && wrapped < 2; type = next) {
 		hp_index = atomic_xchg(&highest_priority_index, -1);
@@ -390,18 +416,38 @@ swp_entry_t get_swap_page(void)
 
 		spin_unlock(&swap_lock);
 		
-		offset = scan_swap_map(si, SWAP_HAS_CACHE);
+		while (n_ret < n_goal) {
+			offset = scan_swap_map(si, SWAP_HAS_CACHE);
+			if (!offset)
+				break;
+			swp_entries[n_ret++] = swp_entry(type, offset);
+		}
 		spin_unlock(&si->lock);
-		if (offset)
-			return swp_entry(type, offset);
+		if (n_ret)
+			goto out;
 		spin_lock(&swap_lock);
 		next = swap_list.next;
 	}
+	spin_unlock(&swap_lock);
+
+out:
+	if (n_ret < n_goal)
+		atomic_long_add(n_goal - n_ret, &nr_swap_pages);
+	return n_ret;
 
-	atomic_long_inc(&nr_swap_pages);
 noswap:
 	spin_unlock(&swap_lock);
-	return (swp_entry_t) {0};
+	return 0;
+}
+
+bool has_usable_swap(void)
+{
+	bool ret;
+
+	spin_lock(&swap_lock);
+	ret = swap_list.head >= 0;
+	spin_unlock(&swap_lock);
+	return ret;
 }
 
 swp_entry_t get_swap_page_of_type(int type)
@@ -425,7 +471,7 @@ swp_entry_t get_swap_page_of_type(int type)
 	return (swp_entry_t) {0};
 }
 
-static struct swap_info_struct *swap_info_get(swp_entry_t entry)
+static struct swap_info_struct *_swap_info_get(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
 	unsigned long offset, type;
@@ -443,7 +489,6 @@ static struct swap_info_struct *swap_info_get(swp_entry_t entry)
 		goto bad_offset;
 	if (!p->swap_map[offset])
 		goto bad_free;
-	spin_lock(&p->lock);
 	return p;
 
 bad_free:
@@ -461,6 +506,31 @@ out:
 	return NULL;
 }
 
+static struct swap_info_struct *swap_info_get(swp_entry_t entry)
+{
+	struct swap_info_struct *p;
+
+	p = _swap_info_get(entry);
+	if (p)
+		spin_lock(&p->lock);
+	return p;
+}
+
+static struct swap_info_struct *swap_info_get_cont(swp_entry_t entry,
+					struct swap_info_struct *q)
+{
+	struct swap_info_struct *p;
+
+	p = _swap_info_get(entry);
+	if (p != q) {
+		if (q != NULL)
+			spin_unlock(&q->lock);
+		if (p != NULL)
+			spin_lock(&p->lock);
+	}
+	return p;
+}
+
 static void set_highest_priority_index(int type)
 {
 	int old_hp_index, new_hp_index;
@@ -475,8 +545,8 @@ static void set_highest_priority_index(int type)
 		old_hp_index, new_hp_index) != old_hp_index);
 }
 
-static unsigned char swap_entry_free(struct swap_info_struct *p,
-				     swp_entry_t entry, unsigned char usage)
+static unsigned char __swap_entry_free(struct swap_info_struct *p,
+				       swp_entry_t entry, unsigned char usage)
 {
 	unsigned long offset = swp_offset(entry);
 	unsigned char count;
@@ -505,62 +575,109 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 		mem_cgroup_uncharge_swap(entry);
 
 	usage = count | has_cache;
-	p->swap_map[offset] = usage;
-
-	
-	if (!usage) {
-		struct gendisk *disk = p->bdev->bd_disk;
-		if (offset < p->lowest_bit)
-			p->lowest_bit = offset;
-		if (offset > p->highest_bit)
-			p->highest_bit = offset;
-		set_highest_priority_index(p->type);
-		atomic_long_inc(&nr_swap_pages);
-		p->inuse_pages--;
-		if ((p->flags & SWP_BLKDEV) &&
-				disk->fops->swap_slot_free_notify)
-			disk->fops->swap_slot_free_notify(p->bdev, offset);
-	}
+	/*
+	 * A slot whose last reference just went away stays SWAP_HAS_CACHE
+	 * until free_swap_slot() hands it back to swap_entry_free(), so it
+	 * can't be reallocated in the meantime.
+	 */
+	p->swap_map[offset] = usage ? usage : SWAP_HAS_CACHE;
 
 	return usage;
 }
 
+static void swap_entry_free(struct swap_info_struct *p, swp_entry_t entry)
+{
+	struct swap_cluster_info *ci;
+	unsigned long offset = swp_offset(entry);
+	struct gendisk *disk = p->bdev->bd_disk;
+
+	ci = lock_cluster(p, offset);
+	VM_BUG_ON(p->swap_map[offset] != SWAP_HAS_CACHE);
+	p->swap_map[offset] = 0;
+	unlock_cluster(ci);
+
+	if (offset < p->lowest_bit)
+		p->lowest_bit = offset;
+	if (offset > p->highest_bit)
+		p->highest_bit = offset;
+	set_highest_priority_index(p->type);
+	atomic_long_inc(&nr_swap_pages);
+	p->inuse_pages--;
+	if ((p->flags & SWP_BLKDEV) &&
+			disk->fops->swap_slot_free_notify)
+		disk->fops->swap_slot_free_notify(p->bdev, offset);
+}
+
 void swap_free(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
+	unsigned char usage;
 
-	p = swap_info_get(entry);
+	p = _swap_info_get(entry);
 	if (p) {
-		swap_entry_free(p, entry, 1);
-		spin_unlock(&p->lock);
+		ci = lock_cluster(p, swp_offset(entry));
+		usage = __swap_entry_free(p, entry, 1);
+		unlock_cluster(ci);
+		if (!usage)
+			free_swap_slot(entry);
 	}
 }
 
 void swapcache_free(swp_entry_t entry, struct page *page)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	unsigned char count;
 
-	p = swap_info_get(entry);
+	p = _swap_info_get(entry);
 	if (p) {
-		count = swap_entry_free(p, entry, SWAP_HAS_CACHE);
+		ci = lock_cluster(p, swp_offset(entry));
+		count = __swap_entry_free(p, entry, SWAP_HAS_CACHE);
 		if (page)
 			mem_cgroup_uncharge_swapcache(page, entry, count != 0);
-		spin_unlock(&p->lock);
+		unlock_cluster(ci);
+		if (!count)
+			free_swap_slot(entry);
 	}
 }
 
+void swapcache_free_entries(swp_entry_t *entries, int n)
+{
+	struct swap_info_struct *p, *prev = NULL;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		p = swap_info_get_cont(entries[i], prev);
+		if (p)
+			swap_entry_free(p, entries[i]);
+		prev = p;
+	}
+	if (prev)
+		spin_unlock(&prev->lock);
+}
+
 int page_swapcount(struct page *page)
 {
-	int count = 0;
-	struct swap_info_struct *p;
 	swp_entry_t entry;
 
 	entry.val = page_private(page);
-	p = swap_info_get(entry);
+	return __swp_swapcount(entry);
+}
+
+int __swp_swapcount(swp_entry_t entry)
+{
+	int count = 0;
+	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
+	unsigned long offset;
+
+	p = _swap_info_get(entry);
 	if (p) {
-		count = swap_count(p->swap_map[swp_offset(entry)]);
-		spin_unlock(&p->lock);
+		offset = swp_offset(entry);
+		ci = lock_cluster(p, offset);
+		count = swap_count(p->swap_map[offset]);
+		unlock_cluster(ci);
 	}
 	return count;
 }
@@ -605,21 +722,27 @@ int try_to_free_swap(struct page *page)
 int free_swap_and_cache(swp_entry_t entry)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	struct page *page = NULL;
+	unsigned char count;
 
 	if (non_swap_entry(entry))
 		return 1;
 
-	p = swap_info_get(entry);
+	p = _swap_info_get(entry);
 	if (p) {
-		if (swap_entry_free(p, entry, 1) == SWAP_HAS_CACHE) {
+		ci = lock_cluster(p, swp_offset(entry));
+		count = __swap_entry_free(p, entry, 1);
+		if (count == SWAP_HAS_CACHE) {
 			page = find_get_page(&swapper_space, entry.val);
 			if (page && !trylock_page(page)) {
 				page_cache_release(page);
 				page = NULL;
 			}
 		}
-		spin_unlock(&p->lock);
+		unlock_cluster(ci);
+		if (!count)
+			free_swap_slot(entry);
 	}
 	if (page) {
 		if (PageSwapCache(page) && !PageWriteback(page) &&
@@ -1234,6 +1357,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct *p = NULL;
 	unsigned char *swap_map;
+	struct swap_cluster_info *cluster_info;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1301,6 +1425,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 
+	disable_swap_slots_cache_lock();
+
 	oom_score_adj = test_set_oom_score_adj(OOM_SCORE_ADJ_MAX);
 	err = try_to_unuse(type);
 	compare_swap_oom_score_adj(OOM_SCORE_ADJ_MAX, oom_score_adj);
@@ -1308,9 +1434,12 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	if (err) {
 		
 		enable_swap_info(p, p->prio, p->swap_map);
+		reenable_swap_slots_cache_unlock();
 		goto out_dput;
 	}
 
+	reenable_swap_slots_cache_unlock();
+
 	destroy_swap_extents(p);
 	if (p->flags & SWP_CONTINUED)
 		free_swap_count_continuations(p);
@@ -1333,13 +1462,21 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	swap_file = p->swap_file;
 	p->swap_file = NULL;
 	p->max = 0;
+	spin_unlock(&p->lock);
+	spin_unlock(&swap_lock);
+	synchronize_rcu();
+	spin_lock(&swap_lock);
+	spin_lock(&p->lock);
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
 	p->flags = 0;
 	spin_unlock(&p->lock);
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(cluster_info);
 	
 	swap_cgroup_swapoff(type);
 
@@ -1531,6 +1668,7 @@ static struct swap_info_struct *alloc_swap_info(void)
 	p->next = -1;
 	spin_unlock(&swap_lock);
 	spin_lock_init(&p->lock);
+	spin_lock_init(&p->cont_lock);
 
 	return p;
 }
@@ -1679,6 +1817,8 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	sector_t span;
 	unsigned long maxpages;
 	unsigned char *swap_map = NULL;
+	struct swap_cluster_info *cluster_info = NULL;
+	unsigned long nr_clusters;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 
@@ -1749,6 +1889,16 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		goto bad_swap;
 	}
 
+	nr_clusters = DIV_ROUND_UP(maxpages, SWAPFILE_CLUSTER);
+	cluster_info = vzalloc(nr_clusters * sizeof(*cluster_info));
+	if (!cluster_info) {
+		error = -ENOMEM;
+		goto bad_swap;
+	}
+	for (i = 0; i < nr_clusters; i++)
+		spin_lock_init(&cluster_info[i].lock);
+	p->cluster_info = cluster_info;
+
 	error = swap_cgroup_swapon(p->type, maxpages);
 	if (error)
 		goto bad_swap;
@@ -1789,6 +1939,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 
 	if (S_ISREG(inode->i_mode))
 		inode->i_flags |= S_SWAPFILE;
+	enable_swap_slots_cache();
 	error = 0;
 	goto out;
 bad_swap:
@@ -1800,9 +1951,11 @@ bad_swap:
 	swap_cgroup_swapoff(p->type);
 	spin_lock(&swap_lock);
 	p->swap_file = NULL;
+	p->cluster_info = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(cluster_info);
 	if (swap_file) {
 		if (inode && S_ISREG(inode->i_mode)) {
 			mutex_unlock(&inode->i_mutex);
@@ -1842,6 +1995,7 @@ void si_swapinfo(struct sysinfo *val)
 static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 {
 	struct swap_info_struct *p;
+	struct swap_cluster_info *ci;
 	unsigned long offset, type;
 	unsigned char count;
 	unsigned char has_cache;
@@ -1856,10 +2010,13 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 	p = swap_info[type];
 	offset = swp_offset(entry);
 
-	spin_lock(&p->lock);
-	if (unlikely(offset >= p->max))
+	/* swapoff waits for a grace period between zeroing max and freeing */
+	rcu_read_lock();
+	if (unlikely(offset >= ACCESS_ONCE(p->max)))
 		goto unlock_out;
 
+	ci = lock_cluster(p, offset);
+
 	count = p->swap_map[offset];
 	has_cache = count & SWAP_HAS_CACHE;
 	count &= ~SWAP_HAS_CACHE;
@@ -1890,8 +2047,9 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 
 	p->swap_map[offset] = count | has_cache;
 
+	unlock_cluster(ci);
 unlock_out:
-	spin_unlock(&p->lock);
+	rcu_read_unlock();
 out:
 	return err;
 
@@ -1944,6 +2102,7 @@ EXPORT_SYMBOL_GPL(__page_file_index);
 int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 {
 	struct swap_info_struct *si;
+	struct swap_cluster_info *ci;
 	struct page *head;
 	struct page *page;
 	struct page *list_page;
@@ -1958,6 +2117,7 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 	}
 
 	offset = swp_offset(entry);
+	ci = lock_cluster(si, offset);
 	count = si->swap_map[offset] & ~SWAP_HAS_CACHE;
 
 	if ((count & ~COUNT_CONTINUED) != SWAP_MAP_MAX) {
@@ -1965,13 +2125,16 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 	}
 
 	if (!page) {
+		unlock_cluster(ci);
 		spin_unlock(&si->lock);
 		return -ENOMEM;
 	}
 
+	spin_lock(&si->cont_lock);
+
 	head = vmalloc_to_page(si->swap_map + offset);
     if (!head) {
-        goto out;
+        goto out_unlock_cont;
     }
 	offset &= ~PAGE_MASK;
 
@@ -1986,19 +2149,22 @@ int add_swap_count_continuation(swp_entry_t entry, gfp_t gfp_mask)
 		unsigned char *map;
 
 		if (!(count & COUNT_CONTINUED))
-			goto out;
+			goto out_unlock_cont;
 
 		map = kmap_atomic(list_page) + offset;
 		count = *map;
 		kunmap_atomic(map);
 
 		if ((count & ~COUNT_CONTINUED) != SWAP_CONT_MAX)
-			goto out;
+			goto out_unlock_cont;
 	}
 
 	list_add_tail(&page->lru, &head->lru);
 	page = NULL;			
+out_unlock_cont:
+	spin_unlock(&si->cont_lock);
 out:
+	unlock_cluster(ci);
 	spin_unlock(&si->lock);
 outer:
 	if (page)
@@ -2006,8 +2172,8 @@ outer:
 	return 0;
 }
 
-static bool swap_count_continued(struct swap_info_struct *si,
-				 pgoff_t offset, unsigned char count)
+static bool __swap_count_continued(struct swap_info_struct *si,
+				   pgoff_t offset, unsigned char count)
 {
 	struct page *head;
 	struct page *page;
@@ -2080,6 +2246,17 @@ init_map:		*map = 0;
 	}
 }
 
+static bool swap_count_continued(struct swap_info_struct *si,
+				 pgoff_t offset, unsigned char count)
+{
+	bool ret;
+
+	spin_lock(&si->cont_lock);
+	ret = __swap_count_continued(si, offset, count);
+	spin_unlock(&si->cont_lock);
+	return ret;
+}
+
 static void free_swap_count_continuations(struct swap_info_struct *si)
 {
 	pgoff_t offset;
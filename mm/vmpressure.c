@@ -0,0 +1,102 @@
+/*
+ * Global reclaim pressure notification
+ *
+ * Copyright (C) 2013 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/swap.h>
+#include <linux/workqueue.h>
+#include <linux/vmpressure.h>
+
+/*
+ * Number of scanned pages after which the pressure is computed and the
+ * notifiers are called.  Small windows make the value noisy, large ones
+ * make it late.
+ */
+static const unsigned long vmpressure_win = SWAP_CLUSTER_MAX * 16;
+
+static unsigned long vmpressure_scanned;
+static unsigned long vmpressure_reclaimed;
+static DEFINE_SPINLOCK(vmpressure_lock);
+
+static BLOCKING_NOTIFIER_HEAD(vmpressure_notifier);
+
+static unsigned long vmpressure_calc(unsigned long scanned,
+				     unsigned long reclaimed)
+{
+	unsigned long scale = scanned + reclaimed;
+	unsigned long pressure;
+
+	if (reclaimed >= scanned)
+		return 0;
+
+	pressure = scale - (reclaimed * scale / scanned);
+	pressure = pressure * 100 / scale;
+
+	return pressure;
+}
+
+static void vmpressure_work_fn(struct work_struct *work)
+{
+	unsigned long scanned;
+	unsigned long reclaimed;
+
+	spin_lock(&vmpressure_lock);
+	scanned = vmpressure_scanned;
+	reclaimed = vmpressure_reclaimed;
+	vmpressure_scanned = 0;
+	vmpressure_reclaimed = 0;
+	spin_unlock(&vmpressure_lock);
+
+	if (!scanned)
+		return;
+
+	blocking_notifier_call_chain(&vmpressure_notifier,
+				     vmpressure_calc(scanned, reclaimed), NULL);
+}
+
+static DECLARE_WORK(vmpressure_work, vmpressure_work_fn);
+
+void vmpressure(gfp_t gfp, unsigned long scanned, unsigned long reclaimed)
+{
+	if (!(gfp & (__GFP_HIGHMEM | __GFP_MOVABLE | __GFP_IO | __GFP_FS)))
+		return;
+
+	if (!scanned)
+		return;
+
+	spin_lock(&vmpressure_lock);
+	vmpressure_scanned += scanned;
+	vmpressure_reclaimed += reclaimed;
+	scanned = vmpressure_scanned;
+	spin_unlock(&vmpressure_lock);
+
+	if (scanned < vmpressure_win)
+		return;
+
+	schedule_work(&vmpressure_work);
+}
+
+int vmpressure_notifier_register(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_notifier_register);
+
+int vmpressure_notifier_unregister(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&vmpressure_notifier, nb);
+}
+EXPORT_SYMBOL_GPL(vmpressure_notifier_unregister);
@@ -11,8 +11,13 @@
 #define __XT_QTAGUID_INTERNAL_H__
 
 #include <linux/types.h>
+#include <linux/cache.h>
+#include <linux/cpumask.h>
 #include <linux/rbtree.h>
+#include <linux/list.h>
+#include <linux/rcupdate.h>
 #include <linux/spinlock_types.h>
+#include <linux/u64_stats_sync.h>
 #include <linux/workqueue.h>
 
 #define IDEBUG_MASK (1<<0)
@@ -103,6 +108,10 @@ static inline tag_t make_atag_from_value(uint32_t value)
 
 #define DEFAULT_MAX_SOCK_TAGS 1024
 
+#define SOCK_TAG_HASH_BITS 8
+#define TAG_COUNTER_SET_HASH_BITS 6
+#define TAG_STAT_HASH_BITS 5
+
 #define IFS_MAX_COUNTER_SETS 2
 
 enum ifs_tx_rx {
@@ -127,6 +136,43 @@ struct data_counters {
 	struct byte_packet_counters bpc[IFS_MAX_COUNTER_SETS][IFS_MAX_DIRECTIONS][IFS_MAX_PROTOS];
 };
 
+/*
+ * One data_counters per possible cpu, indexed by cpu number. Only the
+ * owning cpu writes its slot, from the match with BHs disabled. Slots are
+ * cacheline aligned so neighbouring cpus do not share lines; they are
+ * allocated from atomic context, where alloc_percpu() can not be used.
+ */
+struct data_counters_pcpu {
+	struct data_counters dc;
+	struct u64_stats_sync syncp;
+} ____cacheline_aligned_in_smp;
+
+static inline void dc_pcpu_read(const struct data_counters_pcpu *pcpu,
+				struct data_counters *res)
+{
+	struct data_counters snap;
+	unsigned int start;
+	int cpu, set, dir, proto;
+
+	memset(res, 0, sizeof(*res));
+	for_each_possible_cpu(cpu) {
+		do {
+			start = u64_stats_fetch_begin_bh(&pcpu[cpu].syncp);
+			snap = pcpu[cpu].dc;
+		} while (u64_stats_fetch_retry_bh(&pcpu[cpu].syncp, start));
+
+		for (set = 0; set < IFS_MAX_COUNTER_SETS; set++)
+			for (dir = 0; dir < IFS_MAX_DIRECTIONS; dir++)
+				for (proto = 0; proto < IFS_MAX_PROTOS;
+				     proto++) {
+					res->bpc[set][dir][proto].bytes +=
+						snap.bpc[set][dir][proto].bytes;
+					res->bpc[set][dir][proto].packets +=
+						snap.bpc[set][dir][proto].packets;
+				}
+	}
+}
+
 static inline uint64_t dc_sum_bytes(struct data_counters *counters,
 				    int set,
 				    enum ifs_tx_rx direction)
@@ -148,13 +194,15 @@ static inline uint64_t dc_sum_packets(struct data_counters *counters,
 
 struct tag_node {
 	struct rb_node node;
+	struct hlist_node hash_node;
 	tag_t tag;
 };
 
 struct tag_stat {
 	struct tag_node tn;
-	struct data_counters counters;
-	struct data_counters *parent_counters;
+	struct data_counters_pcpu *counters;
+	struct data_counters_pcpu *parent_counters;
+	struct rcu_head rcu;
 };
 
 struct iface_stat {
@@ -165,7 +213,7 @@ struct iface_stat {
 	struct net_device *net_dev;
 
 	struct byte_packet_counters totals_via_dev[IFS_MAX_DIRECTIONS];
-	struct data_counters totals_via_skb;
+	struct data_counters_pcpu *totals_via_skb;
 	struct byte_packet_counters last_known[IFS_MAX_DIRECTIONS];
 	
 	bool last_known_valid;
@@ -173,6 +221,7 @@ struct iface_stat {
 	struct proc_dir_entry *proc_ptr;
 
 	struct rb_root tag_stat_tree;
+	struct hlist_head tag_stat_hash[1 << TAG_STAT_HASH_BITS];
 	spinlock_t tag_stat_list_lock;
 };
 
@@ -183,6 +232,7 @@ struct iface_stat_work {
 
 struct sock_tag {
 	struct rb_node sock_node;
+	struct hlist_node hash_node;
 	struct sock *sk;  
 	
 	struct socket *socket;
@@ -191,6 +241,7 @@ struct sock_tag {
 	pid_t pid;
 
 	tag_t tag;
+	struct rcu_head rcu;
 };
 
 struct qtaguid_event_counts {
@@ -215,6 +266,7 @@ struct qtaguid_event_counts {
 struct tag_counter_set {
 	struct tag_node tn;
 	int active_set;
+	struct rcu_head rcu;
 };
 
 struct uid_tag_data {
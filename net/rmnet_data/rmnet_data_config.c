@@ -25,6 +25,7 @@
 #include "rmnet_data_handlers.h"
 #include "rmnet_data_vnd.h"
 #include "rmnet_data_private.h"
+#include "rmnet_map.h"
 
 static struct sock *nl_socket_handle;
 #define RMNET_KERNEL_PRE_3_8
@@ -360,6 +361,34 @@ void rmnet_config_netlink_msg_handler(struct sk_buff *skb)
 }
 
 
+static int rmnet_gro_napi_poll(struct napi_struct *napi, int budget)
+{
+	return 0;
+}
+
+static int rmnet_alloc_gro_napi(struct rmnet_phys_ep_conf_s *config)
+{
+	int cpu;
+
+	config->gro_napi = alloc_percpu(struct napi_struct);
+	if (!config->gro_napi)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		netif_napi_add(config->dev, per_cpu_ptr(config->gro_napi, cpu),
+			       rmnet_gro_napi_poll, 64);
+	return 0;
+}
+
+static void rmnet_free_gro_napi(struct rmnet_phys_ep_conf_s *config)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		netif_napi_del(per_cpu_ptr(config->gro_napi, cpu));
+	free_percpu(config->gro_napi);
+}
+
 int rmnet_unassociate_network_device(struct net_device *dev)
 {
 	struct rmnet_phys_ep_conf_s *config;
@@ -379,6 +408,10 @@ int rmnet_unassociate_network_device(struct net_device *dev)
 	if (!config)
 		return RMNET_CONFIG_UNKNOWN_ERROR;
 
+	hrtimer_cancel(&config->agg_timer);
+	tasklet_kill(&config->agg_tasklet);
+	kfree_skb(config->agg_skb);
+	rmnet_free_gro_napi(config);
 	kfree(config);
 
 	netdev_rx_handler_unregister(dev);
@@ -458,12 +491,22 @@ int rmnet_associate_network_device(struct net_device *dev)
 	memset(config, 0, sizeof(struct rmnet_phys_ep_conf_s));
 	config->dev = dev;
 	spin_lock_init(&config->agg_lock);
+	hrtimer_init(&config->agg_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	config->agg_timer.function = rmnet_map_flush_timer;
+	tasklet_init(&config->agg_tasklet, rmnet_map_flush_packet_queue,
+		     (unsigned long)config);
+
+	if (rmnet_alloc_gro_napi(config)) {
+		kfree(config);
+		return RMNET_CONFIG_NOMEM;
+	}
 
 	rc = netdev_rx_handler_register(dev, rmnet_rx_handler, config);
 
 	if (rc) {
 		LOGM("%s(): netdev_rx_handler_register returns %d\n",
 		     __func__, rc);
+		rmnet_free_gro_napi(config);
 		kfree(config);
 		return RMNET_CONFIG_DEVICE_IN_USE;
 	}
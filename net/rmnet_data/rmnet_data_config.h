@@ -16,6 +16,9 @@
 
 #include <linux/types.h>
 #include <linux/spinlock.h>
+#include <linux/netdevice.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
 
 #ifndef _RMNET_DATA_CONFIG_H_
 #define _RMNET_DATA_CONFIG_H_
@@ -35,14 +38,19 @@ struct rmnet_phys_ep_conf_s {
 	struct rmnet_logical_ep_conf_s muxed_ep[RMNET_DATA_MAX_LOGICAL_EP];
 	uint32_t	ingress_data_format;
 	uint32_t	egress_data_format;
+	struct napi_struct __percpu *gro_napi;
 
 	
 	uint16_t egress_agg_size;
 	uint16_t egress_agg_count;
 	spinlock_t agg_lock;
 	struct sk_buff *agg_skb;
+	struct sk_buff *agg_tail;
 	uint8_t agg_state;
-	uint8_t agg_count;
+	uint16_t agg_count;
+	ktime_t agg_start;
+	struct hrtimer agg_timer;
+	struct tasklet_struct agg_tasklet;
 };
 
 int rmnet_config_init(void);
@@ -127,7 +127,8 @@ static rx_handler_result_t rmnet_bridge_handler(struct sk_buff *skb,
 }
 
 static rx_handler_result_t __rmnet_deliver_skb(struct sk_buff *skb,
-					 struct rmnet_logical_ep_conf_s *ep)
+					 struct rmnet_logical_ep_conf_s *ep,
+					 struct napi_struct *napi)
 {
 	switch (ep->rmnet_mode) {
 	case RMNET_EPMODE_NONE:
@@ -145,6 +146,11 @@ static rx_handler_result_t __rmnet_deliver_skb(struct sk_buff *skb,
 
 		case RX_HANDLER_PASS:
 			skb->pkt_type = PACKET_HOST;
+			if (napi) {
+				skb_reset_mac_header(skb);
+				napi_gro_receive(napi, skb);
+				return RX_HANDLER_CONSUMED;
+			}
 			return  RX_HANDLER_ANOTHER;
 		}
 		return RX_HANDLER_PASS;
@@ -169,12 +175,13 @@ static rx_handler_result_t rmnet_ip_ingress_handler(struct sk_buff *skb,
 
 	skb->dev = config->local_ep.egress_dev;
 
-	return __rmnet_deliver_skb(skb, &config->local_ep);
+	return __rmnet_deliver_skb(skb, &config->local_ep, 0);
 }
 
 
 static rx_handler_result_t _rmnet_map_ingress_handler(struct sk_buff *skb,
-					    struct rmnet_phys_ep_conf_s *config)
+					    struct rmnet_phys_ep_conf_s *config,
+					    struct napi_struct *napi)
 {
 	struct rmnet_logical_ep_conf_s *ep;
 	uint8_t mux_id;
@@ -202,31 +209,36 @@ static rx_handler_result_t _rmnet_map_ingress_handler(struct sk_buff *skb,
 
 	if (config->ingress_data_format & RMNET_INGRESS_FORMAT_DEMUXING)
 		skb->dev = ep->egress_dev;
+	else
+		napi = 0;
 
 	
 	skb_pull(skb, sizeof(struct rmnet_map_header_s));
 	skb_trim(skb, len);
 	__rmnet_data_set_skb_proto(skb);
 
-	return __rmnet_deliver_skb(skb, ep);
+	return __rmnet_deliver_skb(skb, ep, napi);
 }
 
 static rx_handler_result_t rmnet_map_ingress_handler(struct sk_buff *skb,
 					    struct rmnet_phys_ep_conf_s *config)
 {
 	struct sk_buff *skbn;
+	struct napi_struct *napi;
 	int rc, co = 0;
 
 	if (config->ingress_data_format & RMNET_INGRESS_FORMAT_DEAGGREGATION) {
+		napi = this_cpu_ptr(config->gro_napi);
 		while ((skbn = rmnet_map_deaggregate(skb, config)) != 0) {
 			LOGD("co=%d\n", co);
-			_rmnet_map_ingress_handler(skbn, config);
+			_rmnet_map_ingress_handler(skbn, config, napi);
 			co++;
 		}
+		napi_gro_flush(napi);
 		kfree_skb(skb);
 		rc = RX_HANDLER_CONSUMED;
 	} else {
-		rc = _rmnet_map_ingress_handler(skb, config);
+		rc = _rmnet_map_ingress_handler(skb, config, 0);
 	}
 
 	return rc;
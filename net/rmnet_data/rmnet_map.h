@@ -18,6 +18,9 @@
 #define _RMNET_MAP_H_
 
 #define RMNET_MAP_MAX_FLOWS 8
+#define RMNET_MAP_DEAGGR_SPACING  64
+#define RMNET_MAP_DEAGGR_HEADROOM (RMNET_MAP_DEAGGR_SPACING/2)
+#define RMNET_MAP_AGG_HIST_SIZE 8
 
 struct rmnet_map_header_s {
 #ifndef RMNET_USE_BIG_ENDIAN_STRUCTS
@@ -148,5 +151,7 @@ rx_handler_result_t rmnet_map_command(struct sk_buff *skb,
 				      struct rmnet_phys_ep_conf_s *config);
 void rmnet_map_aggregate(struct sk_buff *skb,
 			 struct rmnet_phys_ep_conf_s *config);
+enum hrtimer_restart rmnet_map_flush_timer(struct hrtimer *t);
+void rmnet_map_flush_packet_queue(unsigned long data);
 
 #endif 
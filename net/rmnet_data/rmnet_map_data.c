@@ -20,15 +20,28 @@
 #include <linux/netdevice.h>
 #include <linux/rmnet_data.h>
 #include <linux/spinlock.h>
-#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
 #include "rmnet_data_config.h"
 #include "rmnet_map.h"
 #include "rmnet_data_private.h"
 
-struct agg_work {
-	struct delayed_work work;
-	struct rmnet_phys_ep_conf_s *config;
-};
+static long agg_time_limit __read_mostly = 1000000L;
+module_param(agg_time_limit, long, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(agg_time_limit,
+		 "Maximum time in ns packets sit in the agg buf");
+
+/* shared by all endpoints, updated under their agg_lock with irqs off */
+static DEFINE_SPINLOCK(agg_hist_lock);
+
+static unsigned long agg_count_hist[RMNET_MAP_AGG_HIST_SIZE];
+module_param_array(agg_count_hist, ulong, 0, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(agg_count_hist, "Packets per aggregate, log2 buckets");
+
+static unsigned long agg_latency_hist[RMNET_MAP_AGG_HIST_SIZE];
+module_param_array(agg_latency_hist, ulong, 0, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(agg_latency_hist,
+		 "Aggregate hold time, log2 buckets of 128us");
 
 
 struct rmnet_map_header_s *rmnet_map_add_map_header(struct sk_buff *skb,
@@ -79,15 +92,16 @@ struct sk_buff *rmnet_map_deaggregate(struct sk_buff *skb,
 		return 0;
 	}
 
-	skbn = skb_clone(skb, GFP_ATOMIC);
+	skbn = alloc_skb(packet_len + RMNET_MAP_DEAGGR_SPACING, GFP_ATOMIC);
 	if (!skbn)
 		return 0;
 
-	LOGD("Trimming to %d bytes\n", packet_len);
-	LOGD("before skbn->len = %d", skbn->len);
-	skb_trim(skbn, packet_len);
+	skbn->dev = skb->dev;
+	skb_reserve(skbn, RMNET_MAP_DEAGGR_HEADROOM);
+	skb_put(skbn, packet_len);
+	skb_copy_bits(skb, 0, skbn->data, packet_len);
 	skb_pull(skb, packet_len);
-	LOGD("after skbn->len = %d", skbn->len);
+	LOGD("skbn->len = %d", skbn->len);
 
 	
 	ip_byte = (skbn->data[4]) & 0xF0;
@@ -100,26 +114,54 @@ struct sk_buff *rmnet_map_deaggregate(struct sk_buff *skb,
 	return skbn;
 }
 
-static void rmnet_map_flush_packet_queue(struct work_struct *work)
+static struct sk_buff *rmnet_map_detach_agg(
+					struct rmnet_phys_ep_conf_s *config)
+{
+	struct sk_buff *skb;
+	s64 usecs;
+
+	skb = config->agg_skb;
+	if (!skb)
+		return 0;
+
+	if (config->agg_count > 1)
+		LOGL("Agg count: %d\n", config->agg_count);
+
+	usecs = ktime_us_delta(ktime_get(), config->agg_start);
+	spin_lock(&agg_hist_lock);
+	agg_count_hist[min(fls(config->agg_count) - 1,
+			   RMNET_MAP_AGG_HIST_SIZE - 1)]++;
+	agg_latency_hist[min(fls((int)(usecs >> 7)),
+			     RMNET_MAP_AGG_HIST_SIZE - 1)]++;
+	spin_unlock(&agg_hist_lock);
+
+	config->agg_skb = 0;
+	config->agg_tail = 0;
+	config->agg_count = 0;
+	return skb;
+}
+
+enum hrtimer_restart rmnet_map_flush_timer(struct hrtimer *t)
+{
+	struct rmnet_phys_ep_conf_s *config;
+
+	config = container_of(t, struct rmnet_phys_ep_conf_s, agg_timer);
+	tasklet_schedule(&config->agg_tasklet);
+	return HRTIMER_NORESTART;
+}
+
+void rmnet_map_flush_packet_queue(unsigned long data)
 {
-	struct agg_work *real_work;
 	struct rmnet_phys_ep_conf_s *config;
 	unsigned long flags;
 	struct sk_buff *skb;
 
 	skb = 0;
-	real_work = (struct agg_work *)work;
-	config = real_work->config;
-	LOGD("Entering flush thread\n");
+	config = (struct rmnet_phys_ep_conf_s *)data;
+	LOGD("Entering flush tasklet\n");
 	spin_lock_irqsave(&config->agg_lock, flags);
 	if (likely(config->agg_state == RMNET_MAP_TXFER_SCHEDULED)) {
-		if (likely(config->agg_skb)) {
-			
-			if (config->agg_count > 1)
-				LOGL("Agg count: %d\n", config->agg_count);
-			skb = config->agg_skb;
-			config->agg_skb = 0;
-		}
+		skb = rmnet_map_detach_agg(config);
 		config->agg_state = RMNET_MAP_AGG_IDLE;
 	} else {
 		
@@ -130,31 +172,65 @@ static void rmnet_map_flush_packet_queue(struct work_struct *work)
 	spin_unlock_irqrestore(&config->agg_lock, flags);
 	if (skb)
 		dev_queue_xmit(skb);
-	kfree(work);
+}
+
+static struct sk_buff *rmnet_map_new_chain(struct sk_buff *skb)
+{
+	struct sk_buff *agg_skb;
+
+	agg_skb = alloc_skb(0, GFP_ATOMIC);
+	if (!agg_skb)
+		return 0;
+
+	agg_skb->dev = skb->dev;
+	agg_skb->protocol = skb->protocol;
+	agg_skb->priority = skb->priority;
+	skb_shinfo(agg_skb)->frag_list = skb;
+	agg_skb->len = skb->len;
+	agg_skb->data_len = skb->len;
+	agg_skb->truesize += skb->truesize;
+	return agg_skb;
+}
+
+static void rmnet_map_chain_skb(struct rmnet_phys_ep_conf_s *config,
+				struct sk_buff *skb)
+{
+	struct sk_buff *agg_skb = config->agg_skb;
+
+	config->agg_tail->next = skb;
+	config->agg_tail = skb;
+	agg_skb->len += skb->len;
+	agg_skb->data_len += skb->len;
+	agg_skb->truesize += skb->truesize;
 }
 
 void rmnet_map_aggregate(struct sk_buff *skb,
 			 struct rmnet_phys_ep_conf_s *config) {
 	uint8_t *dest_buff;
-	struct agg_work *work;
 	unsigned long flags;
 	struct sk_buff *agg_skb;
-	int size;
+	int size, chain;
 
 
 	if (!skb || !config)
 		BUG();
+	chain = skb->dev->features & NETIF_F_FRAGLIST;
 	size = config->egress_agg_size-skb->len;
 
-	if (size < 2000) {
+	if (!chain && size < 2000) {
 		LOGL("Invalid length %d\n", size);
+		dev_queue_xmit(skb);
 		return;
 	}
 
 new_packet:
 	spin_lock_irqsave(&config->agg_lock, flags);
 	if (!config->agg_skb) {
-		config->agg_skb = skb_copy_expand(skb, 0, size, GFP_ATOMIC);
+		if (chain)
+			config->agg_skb = rmnet_map_new_chain(skb);
+		else
+			config->agg_skb = skb_copy_expand(skb, 0, size,
+							  GFP_ATOMIC);
 		if (!config->agg_skb) {
 			config->agg_skb = 0;
 			config->agg_count = 0;
@@ -162,45 +238,44 @@ new_packet:
 			dev_queue_xmit(skb);
 			return;
 		}
+		config->agg_tail = chain ? skb : 0;
 		config->agg_count = 1;
-		kfree_skb(skb);
+		config->agg_start = ktime_get();
+		if (!chain)
+			kfree_skb(skb);
 		goto schedule;
 	}
 
 	if (skb->len > (config->egress_agg_size - config->agg_skb->len)) {
-		if (config->agg_count > 1)
-			LOGL("Agg count: %d\n", config->agg_count);
-		agg_skb = config->agg_skb;
-		config->agg_skb = 0;
-		config->agg_count = 0;
+		agg_skb = rmnet_map_detach_agg(config);
 		spin_unlock_irqrestore(&config->agg_lock, flags);
 		dev_queue_xmit(agg_skb);
 		goto new_packet;
 	}
 
-	dest_buff = skb_put(config->agg_skb, skb->len);
-	memcpy(dest_buff, skb->data, skb->len);
+	if (chain) {
+		rmnet_map_chain_skb(config, skb);
+	} else {
+		dest_buff = skb_put(config->agg_skb, skb->len);
+		memcpy(dest_buff, skb->data, skb->len);
+		kfree_skb(skb);
+	}
 	config->agg_count++;
-	kfree_skb(skb);
+
+	if (config->egress_agg_count &&
+	    config->agg_count >= config->egress_agg_count) {
+		agg_skb = rmnet_map_detach_agg(config);
+		spin_unlock_irqrestore(&config->agg_lock, flags);
+		dev_queue_xmit(agg_skb);
+		return;
+	}
 
 schedule:
 	if (config->agg_state != RMNET_MAP_TXFER_SCHEDULED) {
-		work = (struct agg_work *)
-			kmalloc(sizeof(struct agg_work), GFP_ATOMIC);
-		if (!work) {
-			LOGE("%s(): Failed to allocate work item for packet %s",
-			     "transfer. DATA PATH LIKELY BROKEN!\n", __func__);
-			config->agg_state = RMNET_MAP_AGG_IDLE;
-			spin_unlock_irqrestore(&config->agg_lock, flags);
-			return;
-		}
-		INIT_DELAYED_WORK((struct delayed_work *)work,
-				  rmnet_map_flush_packet_queue);
-		work->config = config;
 		config->agg_state = RMNET_MAP_TXFER_SCHEDULED;
-		schedule_delayed_work((struct delayed_work *)work, 1);
+		hrtimer_start(&config->agg_timer,
+			      ns_to_ktime(agg_time_limit), HRTIMER_MODE_REL);
 	}
 	spin_unlock_irqrestore(&config->agg_lock, flags);
 	return;
 }
-